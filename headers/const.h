@@ -45,6 +45,16 @@
 #define DEST_NOT_EXIST -2  // Destination process does not exist
 #define SENDMESSAGE  -1    // SYSCALL send message
 #define RECEIVEMESSAGE -2  // SYSCALL receive message
+#define YIELDTO -3         // SYSCALL donate the time slice to a ready process
+#define WAITWORD -4        // SYSCALL block while a word holds the expected value
+#define WAKEWORD -5        // SYSCALL wake the processes blocked on a word
+#define KDOIO -6           // SYSCALL perform an I/O operation without the SSI
+#define READLINE -7        // SYSCALL read a line from a terminal receive buffer
+#define KDOIOV -8          // SYSCALL write a buffer to a printer or terminal without the SSI
+#define DISKIO -9          // SYSCALL read or write a disk block through the disk scheduler
+#define KGETTIME -10       // SYSCALL return the processor time of the caller without the SSI
+#define KGETSUPPORTPTR -11 // SYSCALL return the support structure of the caller without the SSI
+#define KGETPROCESSID -12  // SYSCALL return the process ID of the caller (or its parent) without the SSI
 
 #define SENDMSG 1          // USYSCALL send message
 #define RECEIVEMSG 2       // USYSCALL receive message
@@ -59,12 +69,25 @@
 #define CLOCKWAIT      5
 #define GETSUPPORTPTR  6
 #define GETPROCESSID   7
+#define SETEDF         9
+#define GETLATENCY     10
+#define SETWEIGHT      11
+#define REGSERVER      12
+#define GETBILLEDTIME  13
+#define SLEEP          14
+#define ASYNCDOIO      15
+#define DISKSTATS      16
+#define BATCH          17
+#define REGTEMPLATE    18
+#define SPAWN          19
+#define KILLPROCESS    20
 
 /* System service identifiers */
 #define GET_TOD       1  // Get time-of-day
 #define TERMINATE     2  // Terminate process
 #define WRITEPRINTER  3  // Write to printer
 #define WRITETERMINAL 4  // Write to terminal
+#define READTERMINAL  5  // Read a line from terminal
 
 /* Status register constants */
 #define ALLOFF      0x00000000  // All flags off
@@ -100,6 +123,7 @@
 #define DIRTYON  0x00000400  // Dirty bit enabled
 #define VALIDON  0x00000200  // Valid bit enabled
 #define GLOBALON 0x00000100  // Global bit enabled
+#define SWAPPEDOUT 0x00000001  // Software bit: the page has been written to the backing store
 
 /* EntryHI register constants */
 #define GETPAGENO     0x3FFFF000  // Extract page number
@@ -107,6 +131,7 @@
 #define VPNSHIFT      12  // VPN shift amount
 #define VPNMASK       0xFFFFF000  // VPN mask
 #define ASIDSHIFT     6   // ASID shift amount
+#define GETASID       0x00000FC0  // Extract ASID
 #define SHAREDSEGFLAG 30  // Shared segment flag bit position
 
 /* Index register constants */
@@ -142,6 +167,7 @@
 #define UPROCSTARTADDR 0x800000B0  // User process start address
 #define USERSTACKTOP   0xC0000000  // Top of user stack
 #define KERNELSTACK    0x20001000  // Kernel stack address
+#define NESTSTACKSIZE  0x800       // Kernel stack reserved to the outer interrupt handler
 
 #define SHARED  0x3  // Shared memory
 #define PRIVATE 0x2  // Private memory
@@ -155,7 +181,46 @@
 #define BYTELENGTH 8
 
 #define PSECOND    100000  // Pseudo-second value
+#define WHEELTICK  1000    // Resolution of the timer wheel (microseconds)
+#define WHEELBITS  4       // log2 of the slots of a timer wheel level
+#define WHEELSLOTS (1 << WHEELBITS)  // Slots of a timer wheel level
+#define WHEELLEVELS 3      // Levels of the timer wheel
+#define TERMRINGSIZE 128   // Characters buffered by a terminal receiver
+#define SSISHARDS  2       // Instances of the SSI, the requests are spread by PID
+#define MAXTEMPLATES 4     // Spawn templates that can be registered with REGTEMPLATE
+#define NDEVQUEUES ((DEVINTNUM + 1) * MAXDEV)  // Device queues: one per device, two per terminal
+#define POLLMAXTIME 200    // Longest busy-wait on a device (microseconds)
+#define POLLSLACK  20      // Busy-wait beyond the average completion time (microseconds)
+#define POLLSHIFT  3       // Weight of a new sample in the average completion time (1/8)
+#define KERNELIO   1       // p_kernelIO: a single KDOIO operation
+#define VECTORIO   2       // p_kernelIO: a KDOIOV transfer
+#define DISKBLOCKIO 3      // p_kernelIO: a DISKIO request
+#define VECIOSIZE  128     // Characters of a KDOIOV transfer
+#define VECIORESULT(count, status) (((count) << BYTELENGTH) | ((status) & TERMSTATMASK))
+#define VECIOCOUNT(result)  ((result) >> BYTELENGTH)   // Characters transferred by KDOIOV
+#define VECIOSTATUS(result) ((result) & TERMSTATMASK)  // Last status of KDOIOV, the first error if any
+#define IOBUSY    -4       // ASYNCDOIO refused: the device has a request in progress
+#define TICKETBITS 15      // Bits of an ASYNCDOIO ticket
+#define ASYNCIORESULT(ticket, status) (((ticket) << 16) | ((status) & 0xFFFF))
+#define ASYNCIOTICKET(result) ((result) >> 16)     // Ticket of an ASYNCDOIO completion message
+#define ASYNCIOSTATUS(result) ((result) & 0xFFFF)  // Device status of an ASYNCDOIO completion message
 #define TIMESLICE  5000    // Process time slice
+#define EDFMAXUTIL 900     // Maximum EDF utilization admitted (per mille)
+#define EDFREJECTED -3     // EDF admission control refused the request
+#define HISTBUCKETS 20     // Buckets of the log2 latency histograms
+#define STRIDE1    65536   // Stride of a group with weight 1
+#define STRIDEUNIT 100     // CPU time (microseconds) charged to a group per stride
+#define DEFAULTWEIGHT 10   // Default weight of a scheduling group
+#define MAXWEIGHT  1000    // Maximum weight of a scheduling group
+#define MAXIDLETASKS 4     // Maximum number of idle tasks
+#define IDLEINTMASK 0x0000FC00  // Interrupt lines (2-7) that can make a process ready
+#define SERVEDLINES 0xDE  // Interrupt lines served by the nucleus (all but 0 and 5)
+#define ZEROCHUNK  256     // Words zero-filled by a single idle step
+#define PRIONORMAL 0       // Priority of a best-effort process
+#define PRIOBOOST  1       // Priority of a process other processes are waiting on
+#define PRIOEDF    2       // Priority of an EDF process
+#define WAITBUCKETS 16     // Buckets of the WAITWORD wait table
+#define SWAPLOCKWAITERS 0x1  // Swap pool lock bit: some process is blocked on the lock
 #define NEVER      0x7FFFFFFF  // Never-ending time value
 #define SECOND     1000000  // One second in microseconds
 #define STATESIZE  0x8C  // Processor state size
@@ -175,6 +240,7 @@
 #define FRAMEPOOLSTART (DISKPOOLSTART + (DEVPERINT * PAGESIZE)) /* Start address of the frame pool */
 
 #define SWAP_POOL_AREA 0x20020000  // Address of the swap pool area 
+#define AMPSTACKAREA (SWAP_POOL_AREA + (POOLSIZE * PAGESIZE))  // Kernel stacks of the secondary processors
 
 #define RAMTOP(T) ((T) = ((*((int *)RAMBASEADDR)) + (*((int *)RAMBASESIZE))))  
 /* Macro to compute the top of RAM by reading the base address and size */
@@ -199,6 +265,7 @@
 
 #define UPROCMAX 8  /* Maximum number of user processes */
 #define POOLSIZE (UPROCMAX * 2)  /* Size of the resource pool */
+#define NGROUPS  (UPROCMAX + 1)  /* Scheduling groups: one per ASID, plus group 0 for the processes without support */
 
 #define CHARRECV 5		/* Character received*/
 
@@ -214,6 +281,16 @@
 #define TERM0ADDR 0x10000254  /* Base address for terminal 0 */
 #define PRINTER0ADDR 0x100001D4  /* Base address for printer 0 */
 
+/* Multiprocessor (AMP) constants */
+#ifndef NCPU
+#define NCPU 1  /* Number of processors in use (more than one enables the AMP mode) */
+#endif
+#define IRTSTART    0x10000300  /* Interrupt routing table base address */
+#define IRTENTRIES  48  /* Number of interrupt routing table entries */
+#define IRTCPU0     0x00000001  /* Static routing of an interrupt to processor 0 */
+#define CPUSTATE(cpu) ((state_t *)(BIOSDATAPAGE + ((cpu) * STATESIZE)))  /* Exception state saved for a processor */
+#define CPUPASSUPVECTOR(cpu) ((passupvector_t *)(PASSUPVECTOR + ((cpu) * 0x10)))  /* Pass-up vector of a processor */
+
 /* Terminal and printer status masks */
 #define TERMSTATMASK 0xFF  /* Mask to check terminal status */
 #define READY 1  /* Device ready status */
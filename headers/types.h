@@ -25,6 +25,7 @@ typedef struct swpo_t {
     int swpo_asid;              // Address Space ID (ASID) of the owning process
     unsigned int swpo_page;     // Virtual Page Number (VPN)
     pteEntry_t *swpo_pte_ptr;   // Pointer to the corresponding PTE in the process's page table
+    int swpo_zeroed;            // The free frame has been zero-filled in the background
 } swpo_t;
 
 /* Support-level context for exception handling */
@@ -67,14 +68,72 @@ typedef struct pcb_t {
 
     /* Process ID */
     int p_pid;
+
+    /* TOD of the last insertion in a process queue */
+    cpu_t p_queueTOD;
+
+    /* EDF scheduling class (a period of 0 means best-effort) */
+    cpu_t p_edfPeriod;    // Period in microseconds
+    cpu_t p_edfBudget;    // CPU budget granted in every period
+    cpu_t p_edfRemaining; // Budget left in the current period
+    cpu_t p_edfDeadline;  // Absolute deadline (TOD) of the current period
+
+    /* Priority inheritance */
+    int p_prio;                   // Priority inherited from the waiters
+    struct pcb_t *p_waitingOn;    // Process this one is blocked receiving from
+    struct list_head p_waiters;   // Head of the list of processes waiting on this one
+    struct list_head p_waitLink;  // Linked list node in the waiters list of p_waitingOn
+
+    /* The process and its progeny are being terminated, or are dead and wait for the reaper */
+    int p_dying;
+
+    /* Handed back by a secondary processor: stays on processor 0 until the nucleus handles its exception */
+    int p_ampHold;
+    cpu_t p_ampTime;  // Time run on the secondary processors, not charged yet
+
+    /* Word the process is blocked on with WAITWORD, NULL otherwise */
+    memaddr *p_waitWord;
+
+    /* The process is blocked on a device through KDOIO (KERNELIO) or KDOIOV (VECTORIO): the nucleus completes it */
+    int p_kernelIO;
+    int p_ioDevice;  // Queue of the device, see deviceIndex
+
+    /* Command the process waits to write on its device queue */
+    memaddr *p_ioCommand;
+    unsigned int p_ioValue;
+    int p_ioIssued;  // The command has been written, the next completion is its own
+    memaddr p_ioData;           // DISKIO: frame to read into or write from
+    unsigned int p_ioCylinder;  // DISKIO: cylinder of the block
+
+    /* Timer wheel */
+    unsigned int p_wakeTick;  // Tick at which the sleeping process is woken up
+    int p_wheelLevel;         // Wheel level the process sleeps in, NOPROC if not sleeping
+
+    /* Accounting of the work servers do on behalf of their clients */
+    int p_server;             // The process serves requests: its CPU time is billed to its clients
+    struct pcb_t *p_billTo;   // Client of the request being served
+    int p_billPid;            // PID of that client, in case its PCB was reused
+    cpu_t p_billedTime;       // CPU time servers spent on behalf of this process
 } pcb_t, *pcb_PTR;
 
 
+/* Idle task: performs one bounded step of background work, returns TRUE while work is left */
+typedef int (*idle_task_t)();
+
+/* Fair-share scheduling group: all the processes sharing a support_t/ASID */
+typedef struct sched_group_t {
+    struct list_head g_ready; // Ready best-effort processes of the group
+    int g_weight;             // Share of the CPU given to the group
+    unsigned int g_pass;      // Stride scheduling virtual time
+    unsigned int g_residue;   // CPU time (microseconds) used but not charged yet, less than STRIDEUNIT
+} sched_group_t;
+
 /* Message descriptor for inter-process communication */
 typedef struct msg_t {
     struct list_head m_list;  // Linked list node for message queue
     struct pcb_t *m_sender;   // Pointer to the sender process
     unsigned int m_payload;   // Message payload 
+    cpu_t m_sendTOD;          // TOD of the send
 } msg_t, *msg_PTR;
 
 /* Payload structure for SSI messages */
@@ -95,6 +154,115 @@ typedef struct ssi_do_io_t {
     unsigned int commandValue; // Value to write to the I/O register
 } ssi_do_io_t, *ssi_do_io_PTR;
 
+/* SSI structure for batched requests */
+typedef struct ssi_batch_t {
+    int count;                  // Number of requests
+    ssi_payload_t *requests;    // Requests, served in order
+    unsigned int *results;      // Response of each request served
+} ssi_batch_t, *ssi_batch_PTR;
+
+/* Fields of a process spawned from a template that differ from the template */
+typedef struct ssi_spawn_override_t {
+    memaddr sp;          // Stack pointer, 0 to keep the one of the template
+    unsigned int asid;   // ASID, 0 to keep the one of the template
+    support_t *support;  // Support structure, NULL to keep the one of the template
+} ssi_spawn_override_t;
+
+/* SSI structure for spawning processes from a template */
+typedef struct ssi_spawn_t {
+    int id;                            // Template returned by REGTEMPLATE
+    int count;                         // Number of processes to spawn
+    ssi_spawn_override_t *overrides;   // One per process, NULL to spawn identical processes
+    pcb_PTR *spawned;                  // Processes spawned, in order
+} ssi_spawn_t, *ssi_spawn_PTR;
+
+/* Prebuilt state and support structure of the processes spawned from a template */
+typedef struct spawn_template_t {
+    state_t state;
+    support_t *support;
+} spawn_template_t;
+
+/* SSI structure for EDF scheduling requests */
+typedef struct ssi_edf_t {
+    cpu_t period; // Period in microseconds (0 to go back to best-effort)
+    cpu_t budget; // CPU budget per period in microseconds
+} ssi_edf_t, *ssi_edf_PTR;
+
+/* Log2 latency histogram: bucket 0 counts samples under 1 microsecond,
+   bucket i the samples in [2^(i-1), 2^i) microseconds, the last one everything above */
+typedef struct latency_hist_t {
+    unsigned int buckets[HISTBUCKETS];
+} latency_hist_t;
+
+/* Latency histograms kept by the nucleus */
+typedef struct latency_stats_t {
+    latency_hist_t runqueue_wait; // Ready queue insertion to dispatch
+    latency_hist_t dispatch;      // Kernel entry to dispatch
+    latency_hist_t ssi_service;   // SSI request reception to completion
+    latency_hist_t msg_queueing;  // Message send to reception
+    unsigned int state_saves;     // Processor states saved into a PCB
+    unsigned int in_place_resumes; // PLT preemptions that resumed the process without saving its state
+} latency_stats_t, *latency_stats_PTR;
+
+/* SSI structure for scheduling group weight requests */
+typedef struct ssi_weight_t {
+    int asid;   // Group to configure (0 for the processes without support), the sender's own unless it has no support
+    int weight; // New weight, between 1 and MAXWEIGHT
+} ssi_weight_t, *ssi_weight_PTR;
+
+/* Characters received by a terminal, waiting to be read */
+typedef struct term_ring_t {
+    char buf[TERMRINGSIZE];
+    int head;   // Index of the oldest character
+    int count;  // Characters in the buffer
+    int lines;  // Complete lines (newlines) in the buffer
+    int lost;   // Characters dropped because the buffer was full
+} term_ring_t;
+
+/* Completion time statistics of a device, to choose between polling and interrupts */
+typedef struct dev_poll_t {
+    cpu_t avg;        // Moving average of the completion time (microseconds)
+    cpu_t issued;     // TOD of the last command sent through KDOIO
+    int polled;       // Operations completed by polling
+    int interrupted;  // Operations completed by interrupt
+} dev_poll_t;
+
+/* Transfer of a buffer to a printer or terminal, one character per interrupt */
+typedef struct vec_io_t {
+    char buf[VECIOSIZE];  // Copy of the characters to write
+    int length;           // Characters to write
+    int sent;             // Characters written successfully
+    int active;           // A transfer is queued or in progress on the device
+    int inflight;         // The transfer is in progress on the device
+    unsigned int result;  // VECIORESULT of the last transfer
+    memaddr *command;     // Command register of the device
+} vec_io_t;
+
+/* Request started with ASYNCDOIO, waiting for the device interrupt */
+typedef struct async_io_t {
+    struct pcb_t *owner;  // Process to notify, NULL if it has been terminated
+    unsigned int ticket;  // Ticket returned to the owner
+    int busy;             // The device has not completed the request yet
+} async_io_t;
+
+/* Seek statistics of a disk scheduler */
+typedef struct disk_stats_t {
+    int disk;                   // Disk to report on, chosen by the caller of DISKSTATS
+    unsigned int requests;      // DISKIO requests served
+    unsigned int seeks;         // Seeks performed
+    unsigned int distance;      // Cylinders travelled by the arm
+    unsigned int fifoDistance;  // Cylinders the arm would travel serving the requests in arrival order
+} disk_stats_t, *disk_stats_PTR;
+
+/* Disk scheduler state */
+typedef struct disk_state_t {
+    unsigned int cylinder;     // Current position of the arm
+    int armKnown;              // The arm has not moved since the last DISKIO seek, cylinder is right
+    unsigned int lastArrival;  // Cylinder of the last request received
+    int seeking;               // The command in progress is the seek of a DISKIO request
+    disk_stats_t stats;
+} disk_state_t;
+
 /* SSI structure for printing requests */
 typedef struct sst_print_t {
     int length;  // Length of the string
@@ -42,6 +42,31 @@ pcb_t *allocPcb() {
         tempPcb->p_time = 0;
         tempPcb->p_supportStruct = NULL;
         tempPcb->p_pid = next_pid++;  // Assign and increment PID
+        tempPcb->p_edfPeriod = 0;  // Best-effort by default
+        tempPcb->p_edfBudget = 0;
+        tempPcb->p_edfRemaining = 0;
+        tempPcb->p_edfDeadline = 0;
+        tempPcb->p_prio = PRIONORMAL;  // No waiters yet
+        tempPcb->p_waitingOn = NULL;
+        INIT_LIST_HEAD(&tempPcb->p_waiters);
+        INIT_LIST_HEAD(&tempPcb->p_waitLink);
+        tempPcb->p_waitWord = NULL;
+        tempPcb->p_kernelIO = FALSE;
+        tempPcb->p_ioDevice = NOPROC;
+        tempPcb->p_ioCommand = NULL;
+        tempPcb->p_ioValue = 0;
+        tempPcb->p_ioIssued = FALSE;
+        tempPcb->p_ioData = 0;
+        tempPcb->p_ioCylinder = 0;
+        tempPcb->p_dying = FALSE;
+        tempPcb->p_ampHold = FALSE;
+        tempPcb->p_ampTime = 0;
+        tempPcb->p_wakeTick = 0;
+        tempPcb->p_wheelLevel = NOPROC;  // Not sleeping
+        tempPcb->p_server = FALSE;
+        tempPcb->p_billTo = NULL;
+        tempPcb->p_billPid = 0;
+        tempPcb->p_billedTime = 0;
         tempPcb->p_s.status = ALLOFF;  // Set process status to default
         return tempPcb;
     }
@@ -73,6 +98,7 @@ int emptyProcQ(struct list_head *head) {
  * @param p Pointer to the process to insert
  */
 void insertProcQ(struct list_head *head, pcb_t *p) {
+    STCK(p->p_queueTOD);  // Timestamp the insertion for the latency statistics
     list_add_tail(&p->p_list, head);
 }
 
@@ -0,0 +1,275 @@
+#include "amp.h"
+
+#include "../phase1/headers/pcb.h"
+#include "scheduler.h"
+
+extern void copyRegisters(state_t *dest, state_t *src);
+
+/**
+ * @brief Configures the secondary processors and starts them.
+ * Device interrupts are statically routed to processor 0, so the secondary
+ * processors only ever receive their own PLT interrupt.
+ */
+void initAMP() {
+  amp_lock = 0;
+  amp_offloaded = 0;
+  mkEmptyProcQ(&amp_outbox);
+  mkEmptyProcQ(&amp_inbox);
+
+  for (int cpu = 0; cpu < NCPU; cpu++) {
+    amp_running[cpu] = NULL;
+    amp_dispatch_tod[cpu] = 0;
+  }
+
+  // Nothing else to do in the uniprocessor deployment
+  if (NCPU == 1) return;
+
+  // Route every device interrupt to processor 0
+  for (int i = 0; i < IRTENTRIES; i++) {
+    *((memaddr *)(IRTSTART + (i * WORDLEN))) = IRTCPU0;
+  }
+
+  for (int cpu = 1; cpu < NCPU; cpu++) {
+    // Pass Up Vector for the secondary processor
+    passupvector_t *passUpVec = CPUPASSUPVECTOR(cpu);
+    passUpVec->tlb_refill_handler = (memaddr) ampTLBRefillHandler;
+    passUpVec->tlb_refill_stackPtr = (memaddr) AMPSTACKAREA + (cpu * PAGESIZE);
+    passUpVec->exception_handler = (memaddr) ampExceptionHandler;
+    passUpVec->exception_stackPtr = (memaddr) AMPSTACKAREA + (cpu * PAGESIZE);
+
+    // The secondary processor starts in kernel mode inside its scheduler
+    ampStartStates[cpu].status = ALLOFF;
+    ampStartStates[cpu].reg_sp = (memaddr) AMPSTACKAREA + (cpu * PAGESIZE);
+    ampStartStates[cpu].pc_epc = (memaddr) ampScheduler;
+    ampStartStates[cpu].reg_t9 = (memaddr) ampScheduler;
+    ampStartStates[cpu].entry_hi = 0;
+    INITCPU(cpu, &ampStartStates[cpu]);
+  }
+}
+
+/**
+ * @brief Acquires the lock shared by the processors.
+ */
+void ampAcquire() {
+  while (!CAS((unsigned int *) &amp_lock, 0, 1))
+    ;
+}
+
+/**
+ * @brief Releases the lock shared by the processors.
+ */
+void ampRelease() {
+  amp_lock = 0;
+}
+
+/**
+ * @brief Checks if a process may run on a secondary processor.
+ * Only processes about to run in user mode are offloaded: the nucleus, the SSI,
+ * the SSTs and the support level handlers always run on processor 0. Neither is
+ * a U-proc handed back with an exception, until processor 0 has handled it.
+ *
+ * @param p pointer to the process to check
+ * @return 1 if it can be offloaded, 0 otherwise
+ */
+int isAMPEligible(pcb_t *p) {
+  return NCPU > 1 && !p->p_ampHold && (p->p_s.status & USERPON) != 0;
+}
+
+/**
+ * @brief Hands a ready U-proc over to the secondary processors.
+ *
+ * @param p pointer to the process to offload
+ */
+void ampOffload(pcb_t *p) {
+  ampAcquire();
+  insertProcQ(&amp_outbox, p);
+  amp_offloaded++;
+  ampRelease();
+}
+
+/**
+ * @brief Charges the time a process ran on the secondary processors.
+ * The secondary processors only measure it: the groups and the EDF budgets are
+ * owned by processor 0, which charges it here. The caller must hold the AMP lock.
+ *
+ * @param p pointer to the offloaded process
+ */
+static void ampCharge(pcb_t *p) {
+  if (p->p_ampTime > 0) {
+    chargeElapsed(p, p->p_ampTime);
+    p->p_ampTime = 0;
+  }
+}
+
+/**
+ * @brief Moves the processes handed back by the secondary processors to the ready queue.
+ * Their saved state still points to the instruction that raised the exception,
+ * so it is raised again, and handled, as soon as they run on processor 0: they are
+ * held there (p_ampHold) until the nucleus takes that exception.
+ * The time run by every offloaded process since the last collection is charged too.
+ */
+void ampCollect() {
+  if (NCPU == 1) return;
+
+  ampAcquire();
+  pcb_PTR p;
+  list_for_each_entry(p, &amp_outbox, p_list) {
+    ampCharge(p);
+  }
+  for (int cpu = 1; cpu < NCPU; cpu++) {
+    if (amp_running[cpu] != NULL) ampCharge(amp_running[cpu]);
+  }
+  while (!emptyProcQ(&amp_inbox)) {
+    p = removeProcQ(&amp_inbox);
+    ampCharge(p);
+    readyProcess(p);
+    amp_offloaded--;
+  }
+  ampRelease();
+}
+
+/**
+ * @brief Checks if the process is owned by the secondary processors.
+ *
+ * @param p pointer to the process to check
+ * @return 1 if it is queued for, running on or coming back from a secondary processor, 0 otherwise
+ */
+int isInAMPLists(pcb_t *p) {
+  int found = FALSE;
+  if (NCPU == 1) return found;
+
+  ampAcquire();
+  if (isInList(&amp_outbox, p) || isInList(&amp_inbox, p)) found = TRUE;
+  for (int cpu = 1; cpu < NCPU && !found; cpu++) {
+    if (amp_running[cpu] == p) found = TRUE;
+  }
+  ampRelease();
+  return found;
+}
+
+/**
+ * @brief Takes a process away from the secondary processors before it is destroyed.
+ * A processor running it simply drops it on its next exception.
+ *
+ * @param p pointer to the process to revoke
+ * @return 1 if the process was owned by the secondary processors, 0 otherwise
+ */
+int ampRevoke(pcb_t *p) {
+  int found = FALSE;
+  if (NCPU == 1) return found;
+
+  ampAcquire();
+  if (outProcQ(&amp_outbox, p) != NULL || outProcQ(&amp_inbox, p) != NULL) found = TRUE;
+  for (int cpu = 1; cpu < NCPU && !found; cpu++) {
+    if (amp_running[cpu] == p) {
+      amp_running[cpu] = NULL;
+      found = TRUE;
+    }
+  }
+  if (found) amp_offloaded--;
+  ampRelease();
+  return found;
+}
+
+/**
+ * @brief Checks if a U-proc is running on a secondary processor.
+ * The caller must hold the AMP lock.
+ *
+ * @param asid ASID of the U-proc
+ * @return 1 if it is running on a secondary processor, 0 otherwise
+ */
+int ampIsRunning(int asid) {
+  for (int cpu = 1; cpu < NCPU; cpu++) {
+    if (amp_running[cpu] != NULL && amp_running[cpu]->p_supportStruct != NULL &&
+        amp_running[cpu]->p_supportStruct->sup_asid == asid) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/**
+ * @brief Scheduler of a secondary processor.
+ * Runs the next offloaded U-proc, or waits for the next PLT tick to look again.
+ */
+void ampScheduler() {
+  unsigned int cpu = getPRID();
+
+  ampAcquire();
+  pcb_PTR next = removeProcQ(&amp_outbox);
+  amp_running[cpu] = next;
+  ampRelease();
+
+  // Load the PLT, both as time slice and as polling period
+  setTIMER(TIMESLICE * (*((cpu_t *)TIMESCALEADDR)));
+
+  if (next != NULL) {
+    // Another processor may have changed the page tables since the last dispatch
+    TLBCLR();
+    STCK(amp_dispatch_tod[cpu]);
+    LDST(&next->p_s);
+  } else {
+    setSTATUS(IECON | LOCALTIMERINT | TEBITON);
+    WAIT();
+  }
+}
+
+/**
+ * @brief Handles every exception raised on a secondary processor.
+ * PLT interrupts preempt the running U-proc; any other exception sends it back
+ * to processor 0, where the nucleus and the support level handle it.
+ */
+void ampExceptionHandler() {
+  unsigned int cpu = getPRID();
+  state_t *cpuState = CPUSTATE(cpu);
+
+  ampAcquire();
+  pcb_PTR p = amp_running[cpu];
+  amp_running[cpu] = NULL;
+
+  // The process may have been revoked in the meantime
+  if (p != NULL) {
+    copyRegisters(&p->p_s, cpuState);
+    // Measured on the TOD, processor 0 charges it (see ampCollect)
+    cpu_t now;
+    STCK(now);
+    p->p_ampTime += now - amp_dispatch_tod[cpu];
+    if (((cpuState->cause & GETEXECCODE) >> CAUSESHIFT) == IOINTERRUPTS && CAUSE_IP_GET(cpuState->cause, 1)) {
+      // Time slice expired: give the U-proc back to the secondary processors
+      insertProcQ(&amp_outbox, p);
+    } else {
+      // Let processor 0 handle the exception: it must not offload the process again first
+      p->p_ampHold = TRUE;
+      insertProcQ(&amp_inbox, p);
+    }
+  }
+  ampRelease();
+
+  ampScheduler();
+}
+
+/**
+ * @brief TLB-Refill handler of a secondary processor.
+ * Same as uTLB_RefillHandler, for the U-proc running on this processor.
+ */
+void ampTLBRefillHandler() {
+  unsigned int cpu = getPRID();
+  state_t *cpuState = CPUSTATE(cpu);
+  pcb_PTR p = amp_running[cpu];
+
+  // The process has been revoked: forget about it
+  if (p == NULL) ampScheduler();
+
+  // Extract the page number from entryHi
+  int page = (cpuState->entry_hi & GETPAGENO) >> VPNSHIFT;
+  if (page == 0x3FFFF) {
+    page = 31;
+  }
+
+  pteEntry_t *pgTblEntry = &(p->p_supportStruct->sup_privatePgTbl[page]);
+  setENTRYHI(pgTblEntry->pte_entryHI);
+  setENTRYLO(pgTblEntry->pte_entryLO);
+  TLBWR();
+
+  LDST(cpuState);
+}
@@ -0,0 +1,41 @@
+/*
+  Asymmetric multiprocessing: U-procs on the secondary processors
+*/
+
+#ifndef AMP_H
+#define AMP_H
+
+#include <umps/libumps.h>
+#include "../headers/const.h"
+#include "../headers/types.h"
+
+// lock protecting the queues shared between the processors
+volatile unsigned int amp_lock;
+// U-procs handed by processor 0 to the secondary processors
+struct list_head amp_outbox;
+// processes handed back by the secondary processors to processor 0
+struct list_head amp_inbox;
+// process running on every secondary processor
+pcb_PTR amp_running[NCPU];
+// TOD of the last dispatch on every secondary processor
+cpu_t amp_dispatch_tod[NCPU];
+// number of processes currently owned by the secondary processors
+int amp_offloaded;
+// start states of the secondary processors
+state_t ampStartStates[NCPU];
+
+void initAMP();
+void ampAcquire();
+void ampRelease();
+int isAMPEligible(pcb_t *p);
+void ampOffload(pcb_t *p);
+static void ampCharge(pcb_t *p);
+void ampCollect();
+int isInAMPLists(pcb_t *p);
+int ampRevoke(pcb_t *p);
+int ampIsRunning(int asid);
+void ampScheduler();
+void ampExceptionHandler();
+void ampTLBRefillHandler();
+
+#endif
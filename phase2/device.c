@@ -0,0 +1,578 @@
+#include "device.h"
+
+#include "../phase1/headers/pcb.h"
+#include "../phase1/headers/msg.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include "disk.h"
+
+extern int waiting_count;
+extern pcb_PTR current_process;
+extern state_t *currentState;
+extern struct list_head external_blocked_list[4][MAXDEV];
+extern struct list_head terminal_blocked_list[2][MAXDEV];
+extern term_ring_t term_rings[MAXDEV];
+extern void completeIO(pcb_PTR toUnblock, unsigned int devStatusReg);
+extern struct list_head term_readers[MAXDEV];
+extern dev_poll_t dev_poll[NDEVQUEUES];
+extern vec_io_t vec_io[2][MAXDEV];
+extern async_io_t async_io[NDEVQUEUES];
+extern unsigned int async_ticket;
+extern int dev_busy[NDEVQUEUES];
+extern void saveState(pcb_t *p);
+
+/**
+ * @brief Decodes the device queue of a command register.
+ * The device is decoded from the address itself: registers are laid out by line,
+ * then by device, DEV_REG_SIZE bytes each.
+ *
+ * @param commandAddr address of the command register
+ * @return (line - 3) * MAXDEV + dev, terminal receivers after the transmitters,
+ *         or NOPROC if the address is not a command register
+ */
+int deviceIndex(memaddr *commandAddr) {
+  memaddr addr = (memaddr) commandAddr;
+  if (addr < DEV_REG_START || addr >= DEV_REG_START + (DEVINTNUM * MAXDEV * DEV_REG_SIZE)) return NOPROC;
+
+  unsigned int offset = addr - DEV_REG_START;
+  unsigned int line = 3 + (offset / (MAXDEV * DEV_REG_SIZE));
+  unsigned int dev = (offset / DEV_REG_SIZE) % MAXDEV;
+  unsigned int field = (offset % DEV_REG_SIZE) / WORDLEN;
+
+  if (line == 7) {
+    // recv_command is the second word, transm_command the fourth
+    if (field == 1) return (DEVINTNUM * MAXDEV) + dev;
+    if (field == 3) return ((line - 3) * MAXDEV) + dev;
+    return NOPROC;
+  }
+  // command is the second word of the other devices
+  return field == 1 ? ((line - 3) * MAXDEV) + dev : NOPROC;
+}
+
+/**
+ * @brief Finds the list of processes blocked on a device queue.
+ *
+ * @param index queue of the device, as returned by deviceIndex
+ * @return The blocked list of the device (or terminal sub-device)
+ */
+struct list_head *deviceList(int index) {
+  if (index >= DEVINTNUM * MAXDEV) return &terminal_blocked_list[1][index % MAXDEV];
+  if (index >= (DEVINTNUM - 1) * MAXDEV) return &terminal_blocked_list[0][index % MAXDEV];
+  return &external_blocked_list[index / MAXDEV][index % MAXDEV];
+}
+
+/**
+ * @brief Busy-waits for a device expected to complete quickly.
+ * Polling is tried when the average completion time of the device is below POLLMAXTIME,
+ * for at most the average plus POLLSLACK. Terminal receivers wait for the user, so they are never polled.
+ * The caller checks both conditions.
+ *
+ * @param index queue of the device
+ * @param commandAddr address of the command register, just written
+ * @param status pointer where the status is stored on completion
+ * @return TRUE if the operation completed (and was acknowledged), FALSE otherwise
+ */
+static int pollDevice(int index, memaddr *commandAddr, unsigned int *status) {
+  dev_poll_t *stats = &dev_poll[index];
+  cpu_t budget = stats->avg + POLLSLACK;
+  if (budget > POLLMAXTIME) budget = POLLMAXTIME;
+
+  // The status register is the word before the command register
+  memaddr *statusAddr = commandAddr - 1;
+  cpu_t now;
+  do {
+    STCK(now);
+    if ((*statusAddr & TERMSTATMASK) != BUSY) {
+      *status = *statusAddr;
+      *commandAddr = ACK;
+      recordCompletion(index, now);
+      stats->polled++;
+      return TRUE;
+    }
+  } while (now - stats->issued < budget);
+
+  return FALSE;
+}
+
+/**
+ * @brief Adds a completion time to the moving average of a device.
+ *
+ * @param index queue of the device
+ * @param now TOD of the completion
+ */
+void recordCompletion(int index, cpu_t now) {
+  dev_poll_t *stats = &dev_poll[index];
+  int delta = (int) (now - stats->issued) - (int) stats->avg;
+  stats->avg += delta / (1 << POLLSHIFT);
+}
+
+/**
+ * @brief Finds the KDOIOV transfer of a device queue.
+ *
+ * @param index queue of the device
+ * @return The transfer of the printer or terminal transmitter, NULL for the other devices
+ */
+static vec_io_t *vectorSlot(int index) {
+  if (index / MAXDEV == PRNTINT - 3) return &vec_io[0][index % MAXDEV];
+  if (index / MAXDEV == TERMINT - 3) return &vec_io[1][index % MAXDEV];
+  return NULL;
+}
+
+/**
+ * @brief Sends the next character of a KDOIOV transfer to the device.
+ *
+ * @param index queue of the device
+ * @param vec transfer in progress
+ */
+static void vectorIOIssue(int index, vec_io_t *vec) {
+  unsigned int c = (unsigned char) vec->buf[vec->sent];
+
+  if (index / MAXDEV == PRNTINT - 3) {
+    // data0 is the word after the command register
+    *(vec->command + 1) = c;
+    *vec->command = PRINTCHR;
+  } else {
+    *vec->command = TRANSMITCHAR | (c << BYTELENGTH);
+  }
+  STCK(dev_poll[index].issued);
+}
+
+/**
+ * @brief Writes the command of a queued process to its idle device.
+ *
+ * @param index queue of the device
+ * @param p process whose request starts
+ */
+static void issueIO(int index, pcb_t *p) {
+  dev_busy[index] = TRUE;
+  p->p_ioIssued = TRUE;
+
+  if (p->p_kernelIO == VECTORIO) {
+    vec_io_t *vec = vectorSlot(index);
+    vec->inflight = TRUE;
+    vectorIOIssue(index, vec);
+  } else if (p->p_kernelIO == DISKBLOCKIO) {
+    diskIssue(index, p);
+    STCK(dev_poll[index].issued);
+  } else {
+    diskForget(index);
+    *p->p_ioCommand = p->p_ioValue;
+    STCK(dev_poll[index].issued);
+  }
+}
+
+/**
+ * @brief Blocks a process in the queue of a device until its request completes.
+ * Each device runs one command at a time: the command is written now if the device is idle,
+ * otherwise when the requests ahead of it complete. Terminal receivers are always armed,
+ * so their commands are written right away; a character already buffered by the receiver
+ * completes the request at once, so DOIO receives and READLINE see the input in order.
+ *
+ * @param index queue of the device
+ * @param p process to block, its state already saved
+ * @param command address of the command register
+ * @param value command to write
+ */
+void submitIO(int index, pcb_t *p, memaddr *command, unsigned int value) {
+  p->p_ioDevice = index;
+  p->p_ioCommand = command;
+  p->p_ioValue = value;
+  p->p_ioIssued = FALSE;
+
+  // The SSI calls this with interrupts enabled
+  unsigned int status = getSTATUS();
+  setSTATUS(status & (~IECON));
+  if (index >= DEVINTNUM * MAXDEV && term_rings[index - DEVINTNUM * MAXDEV].count > 0) {
+    waiting_count++;
+    completeIO(p, termTakeChar(index - DEVINTNUM * MAXDEV));
+    setSTATUS(status);
+    return;
+  }
+  if (p->p_kernelIO == DISKBLOCKIO) {
+    diskInsert(index, p);
+  } else {
+    insertProcQ(deviceList(index), p);
+  }
+  waiting_count++;
+  if (index >= DEVINTNUM * MAXDEV) {
+    p->p_ioIssued = TRUE;
+    *command = value;
+  } else if (!dev_busy[index]) {
+    issueIO(index, p);
+  }
+  setSTATUS(status);
+}
+
+/**
+ * @brief Handles the completion of the command in progress on a device, already acknowledged.
+ * Called by the interrupt handler for every device but the terminal receivers: it continues
+ * a DISKIO request after its seek or a KDOIOV transfer, or completes an ASYNCDOIO request,
+ * then starts the next queued command.
+ *
+ * @param index queue of the device
+ * @param status device status of the completion
+ * @return The process whose request is complete, NULL if there is none to unblock
+ */
+pcb_PTR deviceCompleted(int index, unsigned int status) {
+  if (diskIOStep(index, status) || vectorIOStep(index, status)) return NULL;
+  dev_busy[index] = FALSE;
+
+  pcb_PTR done = NULL;
+  if (!asyncIOComplete(index, status)) {
+    struct list_head *blockedList = deviceList(index);
+    pcb_PTR head = headProcQ(blockedList);
+    // The process that issued the command may have been terminated meanwhile
+    if (head != NULL && head->p_ioIssued) done = removeProcQ(blockedList);
+  }
+
+  // Start the next request waiting for the device
+  pcb_PTR next = headProcQ(deviceList(index));
+  if (next != NULL) issueIO(index, next);
+
+  return done;
+}
+
+/**
+ * @brief Starts an I/O operation and waits for its completion, without the SSI.
+ * a1 is the address of the command register, a2 the command. An idle device that usually
+ * completes within a few microseconds is polled, and the status is returned in v0 right away.
+ * Otherwise the caller is queued on the device until the interrupt: the interrupt handler
+ * stores the status in v0 and puts the caller back in its ready queue.
+ * If a1 is not a command register, MSGNOGOOD is returned right away.
+ */
+void kernelDoIO() {
+  memaddr *commandAddr = (memaddr *) currentState->reg_a1;
+  unsigned int commandValue = currentState->reg_a2;
+  int index = deviceIndex(commandAddr);
+
+  // Increment PC to avoid infinite loops
+  currentState->pc_epc += WORDLEN;
+
+  if (index == NOPROC) {
+    currentState->reg_v0 = MSGNOGOOD;
+    return;
+  }
+
+  // Nobody else is using the device: it may be worth waiting here
+  int started = FALSE;
+  unsigned int status;
+  if (index < DEVINTNUM * MAXDEV && !dev_busy[index] && dev_poll[index].avg < POLLMAXTIME) {
+    diskForget(index);
+    *commandAddr = commandValue;
+    STCK(dev_poll[index].issued);
+    if (pollDevice(index, commandAddr, &status)) {
+      currentState->reg_v0 = status;
+      return;
+    }
+    started = TRUE;
+  }
+
+  saveState(current_process);  // Save the current state
+  chargeTime(current_process);  // Consume the EDF budget or the group share
+  current_process->p_kernelIO = KERNELIO;
+  // Too slow this time: wait for the interrupt as the owner of the command
+  if (started) dev_busy[index] = TRUE;
+  submitIO(index, current_process, commandAddr, commandValue);
+  if (started) current_process->p_ioIssued = TRUE;
+
+  current_process = NULL;
+  schedule();
+}
+
+/**
+ * @brief Writes a buffer to a printer or terminal and blocks the caller until the whole
+ * buffer is written, or the first error. The buffer is copied into the nucleus, then the
+ * interrupt handler sends each character as the previous one completes.
+ * a1 is the address of the command register (transm_command for terminals), a2 the buffer
+ * and a3 its length, at most VECIOSIZE. On completion v0 holds VECIORESULT(count, status):
+ * the characters written and the last device status, which is the error if count is short.
+ * An empty buffer returns 0 right away. If a1 is not the command register of a printer or
+ * terminal, a transfer is already queued on it or the length is invalid, MSGNOGOOD is returned.
+ */
+void kernelDoIOV() {
+  memaddr *commandAddr = (memaddr *) currentState->reg_a1;
+  char *buf = (char *) currentState->reg_a2;
+  int length = (int) currentState->reg_a3;
+  int index = deviceIndex(commandAddr);
+  vec_io_t *vec = index == NOPROC ? NULL : vectorSlot(index);
+
+  // Increment PC to avoid infinite loops
+  currentState->pc_epc += WORDLEN;
+
+  if (vec == NULL || vec->active || length < 0 || length > VECIOSIZE) {
+    currentState->reg_v0 = MSGNOGOOD;
+    return;
+  }
+  if (length == 0) {
+    currentState->reg_v0 = 0;
+    return;
+  }
+
+  // The caller may reuse its buffer while the device is still writing
+  for (int i = 0; i < length; i++) {
+    vec->buf[i] = buf[i];
+  }
+  vec->length = length;
+  vec->sent = 0;
+  vec->command = commandAddr;
+  vec->active = TRUE;
+  vec->inflight = FALSE;
+
+  saveState(current_process);  // Save the current state
+  chargeTime(current_process);  // Consume the EDF budget or the group share
+  current_process->p_kernelIO = VECTORIO;
+  submitIO(index, current_process, commandAddr, 0);
+
+  current_process = NULL;
+  schedule();
+}
+
+/**
+ * @brief Continues the KDOIOV transfer of a device after a completion, already acknowledged.
+ * While the characters are written successfully, the next one is sent and nobody is woken up.
+ *
+ * @param index queue of the device
+ * @param status device status of the completion
+ * @return TRUE if the next character was sent, FALSE if no transfer is in progress or it has ended
+ */
+int vectorIOStep(int index, unsigned int status) {
+  vec_io_t *vec = vectorSlot(index);
+  if (vec == NULL || !vec->inflight) return FALSE;
+
+  unsigned int success = index / MAXDEV == PRNTINT - 3 ? READY : OKCHARTRANS;
+  if ((status & TERMSTATMASK) == success) {
+    vec->sent++;
+    if (vec->sent < vec->length) {
+      cpu_t now;
+      STCK(now);
+      recordCompletion(index, now);
+      vectorIOIssue(index, vec);
+      return TRUE;
+    }
+  }
+
+  // Last character or first error: the transfer is over, even if its process is gone
+  vec->active = FALSE;
+  vec->inflight = FALSE;
+  vec->result = VECIORESULT(vec->sent, status);
+  return FALSE;
+}
+
+/**
+ * @brief Returns the result of the last KDOIOV transfer of a device.
+ *
+ * @param index queue of the device
+ * @return VECIORESULT of the transfer
+ */
+unsigned int vectorIOResult(int index) {
+  return vectorSlot(index)->result;
+}
+
+/**
+ * @brief Starts an I/O operation on behalf of a process without blocking it.
+ * The device is reserved for the request until its interrupt; then the nucleus sends the owner
+ * a message with ASYNCIORESULT(ticket, status). The message comes from the owner itself,
+ * so RECEIVEMESSAGE from itself waits for a completion and never takes an SSI reply.
+ * Terminal receivers are served by READLINE and are not accepted.
+ *
+ * @param arg command register and command to write
+ * @param owner process to notify
+ * @return The ticket of the request, MSGNOGOOD if the address is not a valid command register,
+ *         IOBUSY if the device has a request in progress
+ */
+int asyncDoIO(ssi_do_io_t *arg, pcb_t *owner) {
+  int index = deviceIndex(arg->commandAddr);
+  if (index == NOPROC || index >= DEVINTNUM * MAXDEV) return MSGNOGOOD;
+
+  async_io_t *req = &async_io[index];
+  int ticket = IOBUSY;
+
+  // The interrupt handler must not see the request half set up
+  unsigned int status = getSTATUS();
+  setSTATUS(status & (~IECON));
+  if (!dev_busy[index]) {
+    async_ticket = (async_ticket % ((1 << TICKETBITS) - 1)) + 1;
+    ticket = async_ticket;
+    req->owner = owner;
+    req->ticket = ticket;
+    req->busy = TRUE;
+    dev_busy[index] = TRUE;
+    waiting_count++;  // The owner may wait for the completion, it is not a deadlock
+    diskForget(index);
+    *arg->commandAddr = arg->commandValue;
+  }
+  setSTATUS(status);
+
+  return ticket;
+}
+
+/**
+ * @brief Completes the ASYNCDOIO request of a device, already acknowledged.
+ * Called by the interrupt handler before looking for a blocked process.
+ *
+ * @param index queue of the device
+ * @param status device status of the completion
+ * @return TRUE if the completion belonged to an ASYNCDOIO request, FALSE otherwise
+ */
+int asyncIOComplete(int index, unsigned int status) {
+  async_io_t *req = &async_io[index];
+  if (!req->busy) return FALSE;
+
+  req->busy = FALSE;
+  waiting_count--;
+  if (req->owner == NULL) return TRUE;  // Nobody to notify anymore
+
+  pcb_PTR owner = req->owner;
+  req->owner = NULL;
+  msg_PTR toPush = createMessage(owner, ASYNCIORESULT(req->ticket, status));
+  if (toPush != NULL) {
+    // Check before the message is queued: a process waiting for a message is in no list
+    int wake = isWaitingForMessage(owner);
+    insertMessage(&owner->msg_inbox, toPush);
+    if (wake) {
+      stopWaiting(owner);
+      readyProcess(owner);
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * @brief Forgets the I/O requests of a process being destroyed.
+ * The commands already written keep their device busy until the interrupt, which then
+ * notifies nobody; a KDOIOV transfer still queued releases its slot.
+ *
+ * @param p pointer to the process
+ */
+void cancelDeviceIO(pcb_t *p) {
+  for (int i = 0; i < NDEVQUEUES; i++) {
+    if (async_io[i].owner == p) async_io[i].owner = NULL;
+  }
+  if (p->p_kernelIO == VECTORIO) {
+    vec_io_t *vec = vectorSlot(p->p_ioDevice);
+    if (!vec->inflight) vec->active = FALSE;
+  }
+}
+
+/**
+ * @brief Empties the receive buffers and starts receiving on every installed terminal.
+ */
+void initTermRings() {
+  for (int dev = 0; dev < MAXDEV; dev++) {
+    term_rings[dev].head = 0;
+    term_rings[dev].count = 0;
+    term_rings[dev].lines = 0;
+    term_rings[dev].lost = 0;
+
+    termreg_t *devReg = (termreg_t *) DEV_REG_ADDR(TERMINT, dev);
+    if ((devReg->recv_status & TERMSTATMASK) == READY) {
+      devReg->recv_command = RECEIVECHAR;
+    }
+  }
+}
+
+/**
+ * @brief Stores a received character in the buffer of its terminal and asks for the next one.
+ * The processes waiting for a line are woken up once it is complete: they repeat
+ * their READLINE, which now finds the line.
+ *
+ * @param dev terminal number
+ * @param status receive status register, already acknowledged
+ */
+void termReceive(unsigned int dev, unsigned int status) {
+  term_ring_t *ring = &term_rings[dev];
+  termreg_t *devReg = (termreg_t *) DEV_REG_ADDR(TERMINT, dev);
+
+  if ((status & TERMSTATMASK) == RECVD) {
+    char c = (status >> BYTELENGTH) & 0xFF;
+    if (ring->count == TERMRINGSIZE) {
+      ring->lost++;
+    } else {
+      ring->buf[(ring->head + ring->count) % TERMRINGSIZE] = c;
+      ring->count++;
+      if (c == '\n') ring->lines++;
+    }
+  }
+  devReg->recv_command = RECEIVECHAR;
+
+  struct list_head *pos = term_readers[dev].next;
+  while (pos != &term_readers[dev]) {
+    pcb_PTR reader = container_of(pos, pcb_t, p_list);
+    pos = pos->next;
+    if (termLineReady(dev, reader->p_s.reg_a3)) {
+      list_del(&reader->p_list);
+      waiting_count--;
+      readyProcess(reader);
+    }
+  }
+}
+
+/**
+ * @brief Takes the oldest character out of the receive buffer of a terminal.
+ *
+ * @param dev terminal number, its buffer not empty
+ * @return The receive status the character arrived with
+ */
+unsigned int termTakeChar(unsigned int dev) {
+  term_ring_t *ring = &term_rings[dev];
+  char c = ring->buf[ring->head];
+  ring->head = (ring->head + 1) % TERMRINGSIZE;
+  ring->count--;
+  if (c == '\n') ring->lines--;
+  return ((unsigned int) (unsigned char) c << BYTELENGTH) | RECVD;
+}
+
+/**
+ * @brief Checks if a READLINE on a terminal can complete.
+ *
+ * @param dev terminal number
+ * @param max size of the reader's buffer
+ * @return TRUE if the buffer holds a whole line, max characters, or is full
+ */
+int termLineReady(unsigned int dev, int max) {
+  term_ring_t *ring = &term_rings[dev];
+  return ring->lines > 0 || ring->count >= max || ring->count == TERMRINGSIZE;
+}
+
+/**
+ * @brief Copies a line received by a terminal into a buffer.
+ * a1 is the terminal number, a2 the buffer (in kernel memory, no TLB miss may happen here),
+ * a3 its size. The line is returned up to its newline included, or truncated to the size
+ * of the buffer, and v0 is the number of characters copied.
+ * If no line is complete the caller blocks, and the syscall is restarted when it is woken up.
+ */
+void readLine() {
+  unsigned int dev = currentState->reg_a1;
+  char *dest = (char *) currentState->reg_a2;
+  int max = currentState->reg_a3;
+
+  if (dev >= MAXDEV || max <= 0) {
+    currentState->reg_v0 = MSGNOGOOD;
+    currentState->pc_epc += WORDLEN;
+    return;
+  }
+
+  if (!termLineReady(dev, max)) {
+    // Block without moving the PC past the SYSCALL, so it is issued again
+    saveState(current_process);  // Save the current state
+    chargeTime(current_process);  // Consume the EDF budget or the group share
+    insertProcQ(&term_readers[dev], current_process);
+    waiting_count++;
+    current_process = NULL;
+    schedule();
+  }
+
+  term_ring_t *ring = &term_rings[dev];
+  int copied = 0;
+  char c = 0;
+  while (copied < max && ring->count > 0 && c != '\n') {
+    c = ring->buf[ring->head];
+    ring->head = (ring->head + 1) % TERMRINGSIZE;
+    ring->count--;
+    dest[copied++] = c;
+  }
+  if (c == '\n') ring->lines--;
+
+  currentState->reg_v0 = copied;
+  currentState->pc_epc += WORDLEN;
+}
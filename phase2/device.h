@@ -0,0 +1,31 @@
+/*
+  Nucleus device I/O
+*/
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <umps/libumps.h>
+#include <umps/arch.h>
+#include "../headers/const.h"
+#include "../headers/types.h"
+
+int deviceIndex(memaddr *commandAddr);
+struct list_head *deviceList(int index);
+void recordCompletion(int index, cpu_t now);
+void submitIO(int index, pcb_t *p, memaddr *command, unsigned int value);
+pcb_PTR deviceCompleted(int index, unsigned int status);
+void kernelDoIO();
+void kernelDoIOV();
+int vectorIOStep(int index, unsigned int status);
+unsigned int vectorIOResult(int index);
+int asyncDoIO(ssi_do_io_t *arg, pcb_t *owner);
+int asyncIOComplete(int index, unsigned int status);
+void cancelDeviceIO(pcb_t *p);
+void initTermRings();
+void termReceive(unsigned int dev, unsigned int status);
+unsigned int termTakeChar(unsigned int dev);
+int termLineReady(unsigned int dev, int max);
+void readLine();
+
+#endif
@@ -0,0 +1,218 @@
+#include "disk.h"
+
+#include "../phase1/headers/pcb.h"
+#include "scheduler.h"
+#include "device.h"
+
+extern pcb_PTR current_process;
+extern state_t *currentState;
+extern disk_state_t disk_state[MAXDEV];
+extern void saveState(pcb_t *p);
+
+/**
+ * @brief Parks every disk arm on cylinder 0 and clears the statistics.
+ */
+void initDisks() {
+  for (int i = 0; i < MAXDEV; i++) {
+    disk_state[i].cylinder = 0;
+    disk_state[i].armKnown = FALSE;  // The first DISKIO request seeks anyway
+    disk_state[i].lastArrival = 0;
+    disk_state[i].seeking = FALSE;
+    disk_state[i].stats.disk = i;
+    disk_state[i].stats.requests = 0;
+    disk_state[i].stats.seeks = 0;
+    disk_state[i].stats.distance = 0;
+    disk_state[i].stats.fifoDistance = 0;
+  }
+}
+
+/**
+ * @brief Counts the cylinders between two positions of the arm.
+ */
+static unsigned int seekDistance(unsigned int from, unsigned int to) {
+  return from > to ? from - to : to - from;
+}
+
+/**
+ * @brief Orders two DISKIO requests for a C-LOOK sweep.
+ * The arm moves towards higher cylinders: the requests at or after the current position come first,
+ * then the ones behind it, on the next sweep. On the same cylinder the requests follow the head and
+ * sector, so adjacent sectors are transferred back to back with no seek in between.
+ *
+ * @param p request to place
+ * @param q request already queued
+ * @param position cylinder the arm is moving to
+ * @return TRUE if p must be served before q
+ */
+static int diskBefore(pcb_t *p, pcb_t *q, unsigned int position) {
+  int pNextSweep = p->p_ioCylinder < position;
+  int qNextSweep = q->p_ioCylinder < position;
+
+  if (pNextSweep != qNextSweep) return pNextSweep < qNextSweep;
+  if (p->p_ioCylinder != q->p_ioCylinder) return p->p_ioCylinder < q->p_ioCylinder;
+  return (p->p_ioValue >> BYTELENGTH) < (q->p_ioValue >> BYTELENGTH);
+}
+
+/**
+ * @brief Queues a DISKIO request on its disk in C-LOOK order.
+ * The head of the queue is the request in progress and stays there. Any other request
+ * queued on the disk (a plain DOIO) keeps its place: no DISKIO request overtakes it.
+ *
+ * @param index queue of the disk
+ * @param p process of the request
+ */
+void diskInsert(int index, pcb_t *p) {
+  struct list_head *queue = deviceList(index);
+  pcb_PTR head = headProcQ(queue);
+  if (head == NULL) {
+    insertProcQ(queue, p);
+    return;
+  }
+
+  // The sweep only orders the requests behind the last plain DOIO queued
+  pcb_PTR from = head;
+  pcb_PTR q;
+  list_for_each_entry(q, queue, p_list) {
+    if (q->p_kernelIO != DISKBLOCKIO) from = q;
+  }
+
+  unsigned int position = from->p_kernelIO == DISKBLOCKIO ? from->p_ioCylinder : disk_state[index].cylinder;
+  struct list_head *iter = list_next(&from->p_list);
+  while (iter != queue) {
+    q = container_of(iter, pcb_t, p_list);
+    if (diskBefore(p, q, position)) break;
+    iter = list_next(iter);
+  }
+  list_add_tail(&p->p_list, iter);  // Insert before iter
+}
+
+/**
+ * @brief Forgets the position of the arm of a disk.
+ * Called for every command written outside the disk scheduler (DOIO, KDOIO, ASYNCDOIO):
+ * it may be a SEEKTOCYL, so the next DISKIO request seeks before its transfer.
+ *
+ * @param index queue of the device, any device
+ */
+void diskForget(int index) {
+  if (index >= 0 && index < MAXDEV) disk_state[index].armKnown = FALSE;
+}
+
+/**
+ * @brief Starts a DISKIO request: a seek unless the arm is known to be on its cylinder, the transfer otherwise.
+ *
+ * @param index queue of the disk
+ * @param p process of the request
+ */
+void diskIssue(int index, pcb_t *p) {
+  disk_state_t *disk = &disk_state[index];
+
+  if (!disk->armKnown || p->p_ioCylinder != disk->cylinder) {
+    disk->seeking = TRUE;
+    disk->stats.seeks++;
+    disk->stats.distance += seekDistance(disk->cylinder, p->p_ioCylinder);
+    disk->cylinder = p->p_ioCylinder;
+    disk->armKnown = TRUE;
+    *p->p_ioCommand = (p->p_ioCylinder << BYTELENGTH) | SEEKTOCYL;
+  } else {
+    // data0 is the word after the command register
+    *(p->p_ioCommand + 1) = p->p_ioData;
+    *p->p_ioCommand = p->p_ioValue;
+  }
+}
+
+/**
+ * @brief Continues a DISKIO request after its seek, already acknowledged.
+ *
+ * @param index queue of the device
+ * @param status device status of the completion
+ * @return TRUE if the transfer was started, FALSE if the completion ends the command in progress
+ */
+int diskIOStep(int index, unsigned int status) {
+  if (index >= MAXDEV || !disk_state[index].seeking) return FALSE;
+  disk_state[index].seeking = FALSE;
+
+  // A failed seek completes the request with its status, and leaves the arm who knows where
+  if ((status & TERMSTATMASK) != READY) {
+    disk_state[index].armKnown = FALSE;
+    return FALSE;
+  }
+
+  // The process that asked for the seek may have been terminated meanwhile
+  pcb_PTR head = headProcQ(deviceList(index));
+  if (head == NULL || !head->p_ioIssued) return FALSE;
+
+  *(head->p_ioCommand + 1) = head->p_ioData;
+  *head->p_ioCommand = head->p_ioValue;
+  return TRUE;
+}
+
+/**
+ * @brief Reads or writes a disk block through the disk scheduler, without the SSI.
+ * a1 is the address of the disk command register, a2 (block << 8) | DISKREAD or DISKWRITE,
+ * a3 the physical address of the frame. Blocks are numbered sector by sector, then head by
+ * head, then cylinder by cylinder. The caller blocks until the transfer is complete, with the
+ * device status in v0. If a1 is not a disk command register, the operation is unknown or the
+ * block is past the end of the disk, MSGNOGOOD is returned right away.
+ */
+void diskDoIO() {
+  memaddr *commandAddr = (memaddr *) currentState->reg_a1;
+  unsigned int op = currentState->reg_a2 & 0xFF;
+  unsigned int block = currentState->reg_a2 >> BYTELENGTH;
+  int index = deviceIndex(commandAddr);
+
+  // Increment PC to avoid infinite loops
+  currentState->pc_epc += WORDLEN;
+
+  if (index == NOPROC || index >= MAXDEV || (op != DISKREAD && op != DISKWRITE)) {
+    currentState->reg_v0 = MSGNOGOOD;
+    return;
+  }
+
+  // data1 holds the geometry: cylinders, heads and sectors per track
+  unsigned int geometry = *(commandAddr + 2);
+  unsigned int sectors = geometry & 0xFF;
+  unsigned int heads = (geometry >> BYTELENGTH) & 0xFF;
+  unsigned int cylinders = geometry >> 16;
+  if (block >= cylinders * heads * sectors) {
+    currentState->reg_v0 = MSGNOGOOD;
+    return;
+  }
+  unsigned int cylinder = block / (heads * sectors);
+  unsigned int head = (block / sectors) % heads;
+  unsigned int sector = block % sectors;
+
+  // The arm would move this much serving the requests in arrival order
+  disk_state_t *disk = &disk_state[index];
+  disk->stats.requests++;
+  disk->stats.fifoDistance += seekDistance(disk->lastArrival, cylinder);
+  disk->lastArrival = cylinder;
+
+  saveState(current_process);  // Save the current state
+  chargeTime(current_process);  // Consume the EDF budget or the group share
+  current_process->p_kernelIO = DISKBLOCKIO;
+  current_process->p_ioData = (memaddr) currentState->reg_a3;
+  current_process->p_ioCylinder = cylinder;
+  submitIO(index, current_process, commandAddr, (head << 16) | (sector << BYTELENGTH) | op);
+
+  current_process = NULL;
+  schedule();
+}
+
+/**
+ * @brief Copies the seek statistics of a disk.
+ *
+ * @param dest structure to fill, its disk field selects the disk
+ * @return The average seek distance (cylinders) saved per request over arrival order, MSGNOGOOD if dest is NULL or the disk does not exist
+ */
+int copyDiskStats(disk_stats_t *dest) {
+  if (dest == NULL || dest->disk < 0 || dest->disk >= MAXDEV) return MSGNOGOOD;
+
+  disk_stats_t *stats = &disk_state[dest->disk].stats;
+  dest->requests = stats->requests;
+  dest->seeks = stats->seeks;
+  dest->distance = stats->distance;
+  dest->fifoDistance = stats->fifoDistance;
+
+  if (stats->requests == 0) return 0;
+  return ((int) stats->fifoDistance - (int) stats->distance) / (int) stats->requests;
+}
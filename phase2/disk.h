@@ -0,0 +1,21 @@
+/*
+  Nucleus disk scheduler
+*/
+
+#ifndef DISK_H
+#define DISK_H
+
+#include <umps/libumps.h>
+#include <umps/arch.h>
+#include "../headers/const.h"
+#include "../headers/types.h"
+
+void initDisks();
+void diskDoIO();
+void diskInsert(int index, pcb_t *p);
+void diskIssue(int index, pcb_t *p);
+void diskForget(int index);
+int diskIOStep(int index, unsigned int status);
+int copyDiskStats(disk_stats_t *dest);
+
+#endif
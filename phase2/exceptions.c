@@ -4,6 +4,7 @@
 
 extern state_t *currentState;
 extern pcb_PTR current_process;
+extern cpu_t kernel_entry_tod;
 extern void interruptHandler();
 
 /**
@@ -11,6 +12,15 @@ extern void interruptHandler();
  * The function processes different exception codes and dispatches them to their corresponding handlers.
  */
 void exceptionHandler() {
+    // Timestamp the entry for the dispatch latency statistics
+    STCK(kernel_entry_tod);
+
+    // A U-proc handed back by a secondary processor raised its exception again: once
+    // it is handled the process may be offloaded again
+    if (current_process != NULL && ((getCAUSE() & GETEXECCODE) >> CAUSESHIFT) != IOINTERRUPTS) {
+        current_process->p_ampHold = FALSE;
+    }
+
     switch((getCAUSE() & GETEXECCODE) >> CAUSESHIFT) {
         case IOINTERRUPTS:
             // External Device Interrupt - handle interrupts from external devices
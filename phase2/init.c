@@ -3,11 +3,18 @@
 #include "../phase1/headers/pcb.h"
 #include "../phase1/headers/msg.h"
 #include "scheduler.h"
+#include "stats.h"
+#include "timer.h"
+#include "device.h"
+#include "disk.h"
 
 extern void uTLB_RefillHandler();
 extern void exceptionHandler();
 extern void SSIHandler();
 extern void test();
+extern void initAMP();
+extern int nest_level;
+extern int reapDead();
 
 /**
  * @brief Entry point of the operating system.
@@ -17,26 +24,44 @@ void main() {
   // nucleus initialization
   initialize();
 
-  // load Interval Timer 100ms
-  LDIT(PSECOND);
+  // load Interval Timer, no process is sleeping yet
+  programIntervalTimer();
 
-  // instantiate the first process (SSI)
-  ssi_pcb = allocPcb();
-  ssi_pcb->p_s.status |= IEPON | IMON;
-  RAMTOP(ssi_pcb->p_s.reg_sp);
-  ssi_pcb->p_s.pc_epc = (memaddr) SSIHandler;
-  ssi_pcb->p_s.reg_t9 = (memaddr) SSIHandler;
-  insertProcQ(&ready_queue, ssi_pcb);
-  process_count++;
+  // start receiving characters on every terminal
+  initTermRings();
+  initDisks();
+
+  // free the processes killed with KILLPROCESS while the CPU is idle
+  registerIdleTask(reapDead);
+
+  // instantiate the SSI processes, one stack page each below RAMTOP
+  for (int i = 0; i < SSISHARDS; i++) {
+    ssi_shards[i] = allocPcb();
+    // The PLT lets another instance in while a long request opens an interrupt window
+    ssi_shards[i]->p_s.status |= IEPON | IMON | TEBITON;
+    RAMTOP(ssi_shards[i]->p_s.reg_sp);
+    ssi_shards[i]->p_s.reg_sp -= i * PAGESIZE;
+    ssi_shards[i]->p_s.pc_epc = (memaddr) SSIHandler;
+    ssi_shards[i]->p_s.reg_t9 = (memaddr) SSIHandler;
+    ssi_shards[i]->p_server = TRUE;
+    readyProcess(ssi_shards[i]);
+    process_count++;
+  }
+  ssi_pcb = ssi_shards[0];
 
   // instantiate the second process (test)
   p3test_pcb = allocPcb();
   p3test_pcb->p_s.status |= IEPON | IMON | TEBITON;
-  p3test_pcb->p_s.reg_sp = ssi_pcb->p_s.reg_sp - (2 * PAGESIZE);
+  // First stack page below the SSI instances
+  RAMTOP(p3test_pcb->p_s.reg_sp);
+  p3test_pcb->p_s.reg_sp -= SSISHARDS * PAGESIZE;
   p3test_pcb->p_s.pc_epc = p3test_pcb->p_s.reg_t9 = (memaddr) test;
-  insertProcQ(&ready_queue, p3test_pcb);
+  readyProcess(p3test_pcb);
   process_count++;
 
+  // start the secondary processors, if any
+  initAMP();
+
   // call the scheduler to start execution
   schedule();
 }
@@ -60,7 +85,23 @@ static void initialize() {
   process_count = 0;
   waiting_count = 0;
   current_process = NULL;
-  mkEmptyProcQ(&ready_queue);
+  for (int g = 0; g < NGROUPS; g++) {
+    mkEmptyProcQ(&sched_groups[g].g_ready);
+    sched_groups[g].g_weight = DEFAULTWEIGHT;
+    sched_groups[g].g_pass = 0;
+    sched_groups[g].g_residue = 0;
+  }
+  global_pass = 0;
+  mkEmptyProcQ(&edf_queue);
+  mkEmptyProcQ(&edf_throttled_list);
+  mkEmptyProcQ(&boost_queue);
+  for (int i = 0; i < WAITBUCKETS; i++) {
+    mkEmptyProcQ(&wait_table[i]);
+  }
+  edf_utilization = 0;
+  initLatencyStats();
+  idle_task_count = 0;
+  nest_level = 0;
 
   // initialize device blocked lists
   for (int i = 0; i < MAXDEV; i++) {
@@ -72,10 +113,29 @@ static void initialize() {
     // terminal devices
     mkEmptyProcQ(&terminal_blocked_list[0][i]);
     mkEmptyProcQ(&terminal_blocked_list[1][i]);
+    mkEmptyProcQ(&term_readers[i]);
+  }
+  for (int i = 0; i < NDEVQUEUES; i++) {
+    dev_poll[i].avg = 0;  // Try polling first, the measures will tell
+    dev_poll[i].issued = 0;
+    dev_poll[i].polled = 0;
+    dev_poll[i].interrupted = 0;
+    async_io[i].owner = NULL;
+    async_io[i].busy = FALSE;
+    dev_busy[i] = FALSE;
+  }
+  async_ticket = 0;
+  template_count = 0;
+  mkEmptyProcQ(&reap_list);
+  for (int i = 0; i < MAXDEV; i++) {
+    vec_io[0][i].active = FALSE;
+    vec_io[1][i].active = FALSE;
+    vec_io[0][i].inflight = FALSE;
+    vec_io[1][i].inflight = FALSE;
   }
 
-  // initialize pseudoclock blocked list
-  mkEmptyProcQ(&pseudoclock_blocked_list);
+  // initialize the timer wheel, which also serves the pseudoclock waits
+  initTimerWheel();
 
   // set current state to BIOS data page
   currentState = (state_t *)BIOSDATAPAGE;
@@ -98,6 +158,7 @@ int isInDevicesLists(pcb_t *p) {
     // check for terminal devices
     if (isInList(&terminal_blocked_list[0][i], p)) return TRUE;
     if (isInList(&terminal_blocked_list[1][i], p)) return TRUE;
+    if (isInList(&term_readers[i], p)) return TRUE;
   }
   return FALSE;
 }
@@ -109,41 +170,21 @@ int isInDevicesLists(pcb_t *p) {
  * @param src state to copy the values from
  */
 void copyRegisters(state_t *dest, state_t *src) {
-  dest->cause = src->cause;
-  dest->entry_hi = src->entry_hi;
-  dest->reg_at = src->reg_at;
-  dest->reg_v0 = src->reg_v0;
-  dest->reg_v1 = src->reg_v1;
-  dest->reg_a0 = src->reg_a0;
-  dest->reg_a1 = src->reg_a1;
-  dest->reg_a2 = src->reg_a2;
-  dest->reg_a3 = src->reg_a3;
-  dest->reg_t0 = src->reg_t0;
-  dest->reg_t1 = src->reg_t1;
-  dest->reg_t2 = src->reg_t2;
-  dest->reg_t3 = src->reg_t3;
-  dest->reg_t4 = src->reg_t4;
-  dest->reg_t5 = src->reg_t5;
-  dest->reg_t6 = src->reg_t6;
-  dest->reg_t7 = src->reg_t7;
-  dest->reg_s0 = src->reg_s0;
-  dest->reg_s1 = src->reg_s1;
-  dest->reg_s2 = src->reg_s2;
-  dest->reg_s3 = src->reg_s3;
-  dest->reg_s4 = src->reg_s4;
-  dest->reg_s5 = src->reg_s5;
-  dest->reg_s6 = src->reg_s6;
-  dest->reg_s7 = src->reg_s7;
-  dest->reg_t8 = src->reg_t8;
-  dest->reg_t9 = src->reg_t9;
-  dest->reg_gp = src->reg_gp;
-  dest->reg_sp = src->reg_sp;
-  dest->reg_fp = src->reg_fp;
-  dest->reg_ra = src->reg_ra;
-  dest->reg_HI = src->reg_HI;
-  dest->reg_LO = src->reg_LO;
-  dest->hi = src->hi;
-  dest->lo = src->lo;
-  dest->pc_epc = src->pc_epc;
-  dest->status = src->status;
+  // Word by word: state_t is 35 words, and reg_HI/reg_LO are the same words as hi/lo
+  unsigned int *d = (unsigned int *) dest;
+  unsigned int *s = (unsigned int *) src;
+  for (int i = 0; i < sizeof(state_t) / WORDLEN; i++) {
+    d[i] = s[i];
+  }
+}
+
+/**
+ * @brief Saves the state of the process from the BIOS data page into its PCB.
+ * Needed only when the process is not going to be resumed right away.
+ *
+ * @param p pointer to the process leaving the CPU
+ */
+void saveState(pcb_t *p) {
+  copyRegisters(&p->p_s, currentState);
+  latency_stats.state_saves++;
 }
@@ -14,16 +14,64 @@ int process_count;
 int waiting_count;
 // running process
 pcb_PTR current_process;
-// queue of PCBs in ready state
-struct list_head ready_queue;
+// best-effort scheduling groups, each with its queue of PCBs in ready state
+sched_group_t sched_groups[NGROUPS];
+// virtual time of the last group served
+unsigned int global_pass;
+// queue of EDF PCBs in ready state, ordered by deadline
+struct list_head edf_queue;
+// list of EDF PCBs that exhausted their budget, waiting for their next period
+struct list_head edf_throttled_list;
+// queue of PCBs in ready state boosted by their waiters, ordered by priority
+struct list_head boost_queue;
+// EDF utilization admitted so far (per mille)
+int edf_utilization;
+// TOD of the last dispatch
+cpu_t dispatch_tod;
+// TOD of the last entry in the nucleus
+cpu_t kernel_entry_tod;
+// latency histograms
+latency_stats_t latency_stats;
+// background jobs run when no process is ready
+idle_task_t idle_tasks[MAXIDLETASKS];
+int idle_task_count;
+// hashed lists of PCBs blocked with WAITWORD
+struct list_head wait_table[WAITBUCKETS];
 // a list of blocked PCBs for every external device
 struct list_head external_blocked_list[4][MAXDEV];
-// list of blocked PCBs for the pseudo-clock
-struct list_head pseudoclock_blocked_list;
+// timer wheel of the sleeping PCBs, one list per slot
+struct list_head timer_wheel[WHEELLEVELS][WHEELSLOTS];
+// number of sleeping PCBs in each level of the wheel
+int wheel_count[WHEELLEVELS];
+// last tick processed by the wheel
+unsigned int wheel_now;
+// raw TOD value at the start of tick wheel_now
+unsigned int wheel_tod;
 // a list of blocked PCBs for every terminal (transmitter and receiver)
 struct list_head terminal_blocked_list[2][MAXDEV];
+// characters received by every terminal, and the PCBs blocked waiting for a line
+term_ring_t term_rings[MAXDEV];
+struct list_head term_readers[MAXDEV];
+// completion times of the devices used through KDOIO
+dev_poll_t dev_poll[NDEVQUEUES];
+// KDOIOV transfers of the printers (0) and of the terminal transmitters (1)
+vec_io_t vec_io[2][MAXDEV];
+// ASYNCDOIO requests of every device queue, and the last ticket handed out
+async_io_t async_io[NDEVQUEUES];
+unsigned int async_ticket;
+// device queues with a command in progress
+int dev_busy[NDEVQUEUES];
+// arm position and statistics of the disk schedulers
+disk_state_t disk_state[MAXDEV];
+// templates registered with REGTEMPLATE, and how many there are
+spawn_template_t spawn_templates[MAXTEMPLATES];
+int template_count;
+// roots of the trees killed with KILLPROCESS, linked through p_sib, waiting for the reaper
+struct list_head reap_list;
 // SSI process
 pcb_PTR ssi_pcb;
+// SSI instances, ssi_pcb is the first one and the address of all of them
+pcb_PTR ssi_shards[SSISHARDS];
 // p2test process
 pcb_PTR p3test_pcb;
 // processor0's state at exception time
@@ -35,5 +83,6 @@ unsigned int *stateCauseReg;
 static void initialize();
 int isInDevicesLists(pcb_t *p);
 void copyRegisters(state_t *dest, state_t *src);
+void saveState(pcb_t *p);
 
 #endif
\ No newline at end of file
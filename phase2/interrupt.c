@@ -3,17 +3,23 @@
 #include "../phase1/headers/pcb.h"
 #include "../phase1/headers/msg.h"
 #include "scheduler.h"
+#include "timer.h"
+#include "device.h"
+#include "stats.h"
 
 extern int waiting_count;
 extern pcb_PTR current_process;
-extern struct list_head ready_queue;
 extern struct list_head external_blocked_list[4][MAXDEV];
-extern struct list_head pseudoclock_blocked_list;
 extern struct list_head terminal_blocked_list[2][MAXDEV];
-extern pcb_PTR ssi_pcb;
 extern state_t *currentState;
+extern cpu_t kernel_entry_tod;
+extern cpu_t dispatch_tod;
+extern latency_stats_t latency_stats;
+extern dev_poll_t dev_poll[NDEVQUEUES];
 extern void copyRegisters(state_t *dest, state_t *src);
+extern void saveState(pcb_t *p);
 extern msg_PTR createMessage(pcb_PTR sender, unsigned int payload);
+extern pcb_PTR ssiShard(pcb_PTR p);
 
 // Payload for direct message to SSI when IO operation ends
 ssi_payload_t payloadDM = {
@@ -23,126 +29,216 @@ ssi_payload_t payloadDM = {
 
 /**
  * Handles all types of interrupts.
- * This function processes interrupts based on their line number and manages the execution flow.
+ * A single entry drains every pending line and device, lowest line first, then
+ * takes one dispatch decision for all the completions.
+ * Between two devices the timers (and the terminals, while serving the other devices)
+ * can interrupt the handler itself.
  */
 void interruptHandler() {
-    unsigned int causeReg = getCAUSE();
+    // Interrupt taken inside an interrupt window of the handler
+    if(nest_level > 0)
+        nestedInterruptHandler();
+
     // Interrupts are globally enabled
     if(((currentState->status & IEPON) >> 2) == 1) {
+        int pltExpired = FALSE;
+        nest_state_saved = FALSE;
+        nest_plt_expired = FALSE;
+
+        // Pending lines not masked in the interrupted state (inter-processor and network interrupts are ignored)
+        unsigned int pending = ((getCAUSE() & currentState->status & IMON) >> 8) & SERVEDLINES;
 
-        for(int line = 0; line < 8; line++) {
-            // Check if the current interrupt line is active
-            if(intPendingInLine(causeReg, line)) {
-                switch(line) {
-                    case 0:
-                    break;
-                    case 1:
-                        if(intLineActive(1)) {
-                            // Time slice for the current running process has expired
-                            PLTInterruptHandler();
-                        }
-                    break;
-                    case 2:
-                        if(intLineActive(2)) {
-                            // Interval timer interrupt (pseudoclock)
-                            ITInterruptHandler();
-                        }   
-                    break;
-                    case 5:
-                    break;
-                    default:
-                        // If the current interrupt line is active, check for device-specific interrupts
-                        if(intLineActive(line)) {
-
-                            unsigned int *intLaneMapped = (memaddr *)(INTDEVBITMAP + (0x4 * (line - 3)));
-
-                            for(int dev = 0; dev < 8; dev++) {
-                                if(intPendingOnDev(intLaneMapped, dev)) {
-                                    
-                                    pcb_PTR toUnblock;
-                                    unsigned int devStatusReg;
-
-                                    // Handle terminal device interrupts (both transmit and receive)
-                                    if(line == 7) {
-                                        toUnblock = termDevInterruptHandler(&devStatusReg, line, dev);
-                                    }
-                                    // Handle external device interrupts
-                                    else {
-                                        toUnblock = extDevInterruptHandler(&devStatusReg, line, dev);
-                                    }
-                                    
-                                    // If there's a process to unblock, update its state and send a message to SSI
-                                    if(toUnblock != NULL) {
-                                        waiting_count--;
-                                        toUnblock->p_s.reg_v0 = devStatusReg;
-
-                                        // Create a message to SSI to unblock the process
-                                        msg_PTR toPush = createMessage(toUnblock, (unsigned int) &payloadDM);
-                                        if (toPush != NULL) {
-                                            insertMessage(&ssi_pcb->msg_inbox, toPush);
-                                            // If SSI is not executing or in readyQueue, move it there
-                                            if (ssi_pcb != current_process && !isInList(&ready_queue, ssi_pcb)) {
-                                                insertProcQ(&ready_queue, ssi_pcb);
-                                            }
-                                        } 
-                                    }
-
-                                    // Schedule the next process if needed
-                                    if(current_process == NULL)
-                                        schedule();
-                                    else
-                                        LDST(currentState);
-                                }
-                            }
-                        }
-                    break;
+        while(pending != 0) {
+            unsigned int line = firstSetBit(pending);
+            pending &= pending - 1;
+
+            if(line == 1) {
+                // Time slice for the current running process has expired, handled last
+                pltExpired = TRUE;
+            } else if(line == 2) {
+                // Interval timer interrupt: wake up the expired sleepers
+                timerInterruptHandler();
+            } else {
+                // Serve every device with a pending interrupt, a terminal may need two rounds
+                unsigned int *intLaneMapped = (memaddr *)(INTDEVBITMAP + (0x4 * (line - 3)));
+                unsigned int devices;
+                while((devices = *intLaneMapped & 0xFF) != 0) {
+                    devInterruptHandler(line, firstSetBit(devices));
+                    interruptWindow(line);
                 }
             }
         }
+
+        // Give the interrupted process its state back
+        if(nest_state_saved)
+            copyRegisters(currentState, &nest_saved_state);
+        if(nest_plt_expired)
+            pltExpired = TRUE;
+
+        // Schedule the next process if needed
+        if(current_process == NULL)
+            schedule();
+        else if(pltExpired)
+            PLTInterruptHandler();
+        else if(edfPreempts(current_process))
+            preemptProcess();
+        else
+            LDST(currentState);
     }
 }
 
 /**
- * Given the interrupt line and device interrupt line, calculate the base address of the device register.
+ * Briefly enables the interrupts of higher priority than a device line: the timers,
+ * and the terminals while serving the other devices. Every list and queue is only
+ * changed with interrupts disabled, so the nested handler can serve them completely.
  * 
- * @param intLine Interrupt line number
- * @param devIntLine Device interrupt line number
- * @return Base address of the device register
+ * @param line Interrupt line just served
  */
-memaddr *getDevReg(unsigned int intLine, unsigned int devIntLine) {
-    return DEV_REG_ADDR(intLine, devIntLine);
+void interruptWindow(unsigned int line) {
+    unsigned int mask = LOCALTIMERINT | TIMERINTERRUPT | (line < 7 ? TERMINTERRUPT : 0);
+
+    // Only the lines enabled in the interrupted state
+    mask &= currentState->status & IMON;
+    if(mask == 0)
+        return;
+
+    // The nested interrupt overwrites the BIOS data page
+    if(!nest_state_saved) {
+        copyRegisters(&nest_saved_state, currentState);
+        nest_state_saved = TRUE;
+    }
+    cpu_t entryTOD = kernel_entry_tod;
+
+    // The nested handler runs on the stack below the one in use
+    passupvector_t *passUpVec = (passupvector_t *) PASSUPVECTOR;
+    passUpVec->exception_stackPtr = (memaddr) KERNELSTACK - NESTSTACKSIZE;
+    nest_level = 1;
+
+    setSTATUS((getSTATUS() & (~IMON)) | mask | IECON);
+    setSTATUS(getSTATUS() & (~IECON));
+
+    nest_level = 0;
+    passUpVec->exception_stackPtr = (memaddr) KERNELSTACK;
+    kernel_entry_tod = entryTOD;
+}
+
+/**
+ * Handles an interrupt taken inside an interrupt window.
+ * It runs with interrupts disabled and never dispatches: the PLT expiration is only
+ * recorded, and the outer handler takes the dispatch decision once it is done.
+ */
+void nestedInterruptHandler() {
+    state_t *outerState = (state_t *) BIOSDATAPAGE;
+    unsigned int pending = ((getCAUSE() & outerState->status & IMON) >> 8) & SERVEDLINES;
+
+    while(pending != 0) {
+        unsigned int line = firstSetBit(pending);
+        pending &= pending - 1;
+
+        if(line == 1) {
+            // Acknowledge the PLT, the scheduler reloads it
+            nest_plt_expired = TRUE;
+            setTIMER(NEVER);
+        } else if(line == 2) {
+            timerInterruptHandler();
+        } else {
+            unsigned int *intLaneMapped = (memaddr *)(INTDEVBITMAP + (0x4 * (line - 3)));
+            unsigned int devices;
+            while((devices = *intLaneMapped & 0xFF) != 0) {
+                devInterruptHandler(line, firstSetBit(devices));
+            }
+        }
+    }
+
+    // Resume the outer handler
+    LDST(outerState);
 }
 
 /**
- * Checks if a specific interrupt line is active or masked.
+ * Finds the lowest bit set in a byte.
  * 
- * @param line Interrupt line number
- * @return 1 if active, 0 if masked
+ * @param bits Byte to scan, must not be 0
+ * @return Index of the lowest bit set
  */
-unsigned short int intLineActive(unsigned short int line) {
-    return (((currentState->status & IMON) >> (8 + line)) & 0x1) == 1; 
+unsigned int firstSetBit(unsigned int bits) {
+    if(bits & 0xF)
+        return lowestBitInNibble[bits & 0xF];
+    return 4 + lowestBitInNibble[(bits >> 4) & 0xF];
 }
 
 /**
- * Checks if there is a pending interrupt in a specific interrupt line.
+ * Acknowledges the interrupt of a device and completes the request of the process waiting for it,
+ * directly or through the SSI.
  * 
- * @param causeReg Cause register value
  * @param line Interrupt line number
- * @return 1 if interrupt is pending, 0 if not
+ * @param dev Device number
  */
-unsigned short int intPendingInLine(unsigned int causeReg, unsigned short int line) {
-    return (((causeReg & interruptConsts[line]) >> (8 + line))) == 1;
+void devInterruptHandler(unsigned int line, unsigned int dev) {
+    pcb_PTR toUnblock;
+    unsigned int devStatusReg;
+
+    // Handle terminal device interrupts (both transmit and receive)
+    if(line == 7) {
+        toUnblock = termDevInterruptHandler(&devStatusReg, line, dev);
+    }
+    // Handle external device interrupts
+    else {
+        toUnblock = extDevInterruptHandler(&devStatusReg, line, dev);
+    }
+
+    if(toUnblock != NULL && toUnblock->p_kernelIO) {
+        // Requested with KDOIO: measure how long the device took
+        cpu_t now;
+        STCK(now);
+        recordCompletion(toUnblock->p_ioDevice, now);
+        dev_poll[toUnblock->p_ioDevice].interrupted++;
+    }
+    if(toUnblock != NULL) {
+        completeIO(toUnblock, devStatusReg);
+    }
 }
 
 /**
- * Checks if a specific device has triggered an interrupt.
+ * Completes the device request of a blocked process, directly or through the SSI.
  * 
- * @param intLaneMapped Pointer to the interrupt lane map
- * @param dev Device number
- * @return 1 if interrupt is pending on the device, 0 if not
+ * @param toUnblock Process whose request is complete, counted in waiting_count
+ * @param devStatusReg Device status of the completion
  */
-unsigned short int intPendingOnDev(unsigned int *intLaneMapped, unsigned int dev) {
-    return (((*intLaneMapped) & deviceConsts[dev]) >> dev) == 1;
+void completeIO(pcb_PTR toUnblock, unsigned int devStatusReg) {
+    if(toUnblock->p_kernelIO) {
+        // Requested with KDOIO: return the status and unblock the process directly
+        waiting_count--;
+        toUnblock->p_s.reg_v0 = toUnblock->p_kernelIO == VECTORIO ? vectorIOResult(toUnblock->p_ioDevice) : devStatusReg;
+        toUnblock->p_kernelIO = FALSE;
+        readyProcess(toUnblock);
+    }
+    // Otherwise update its state and send a message to SSI
+    else {
+        waiting_count--;
+        toUnblock->p_s.reg_v0 = devStatusReg;
+
+        // Create a message to the SSI instance of the process to unblock it
+        pcb_PTR ssi = ssiShard(toUnblock);
+        msg_PTR toPush = createMessage(toUnblock, (unsigned int) &payloadDM);
+        if (toPush != NULL) {
+            insertMessage(&ssi->msg_inbox, toPush);
+            // If SSI is not executing or in readyQueue, move it there
+            if (ssi != current_process && !isReady(ssi)) {
+                readyProcess(ssi);
+            }
+        } 
+    }
+}
+
+/**
+ * Given the interrupt line and device interrupt line, calculate the base address of the device register.
+ * 
+ * @param intLine Interrupt line number
+ * @param devIntLine Device interrupt line number
+ * @return Base address of the device register
+ */
+memaddr *getDevReg(unsigned int intLine, unsigned int devIntLine) {
+    return DEV_REG_ADDR(intLine, devIntLine);
 }
 
 /**
@@ -150,29 +246,31 @@ unsigned short int intPendingOnDev(unsigned int *intLaneMapped, unsigned int dev
  * Saves the current process state and moves it to the ready queue.
  */
 void PLTInterruptHandler() {
-    copyRegisters(&current_process->p_s, currentState);
-    current_process->p_time += TIMESLICE;
-    insertProcQ(&ready_queue, current_process);
+    chargeTime(current_process);
+    // Nobody else would get the CPU: give the process a new slice straight from the BIOS data page
+    if (canResumeInPlace(current_process)) {
+        latency_stats.in_place_resumes++;
+        recordLatency(&latency_stats.dispatch, kernel_entry_tod);
+        STCK(dispatch_tod);
+        setTIMER(timeSlice(current_process) * (*((cpu_t *)TIMESCALEADDR)));
+        LDST(currentState);
+    }
+    saveState(current_process);
+    readyProcess(current_process);
     current_process = NULL;
     schedule();
 }
 
 /**
- * Handles the interrupt generated by the interval timer (pseudoclock).
- * Moves processes waiting for the pseudoclock to the ready queue.
+ * Preempts the running process in favour of a ready EDF process with an earlier deadline.
+ * Saves the current process state and moves it back to its ready queue.
  */
-void ITInterruptHandler() {
-    LDIT(PSECOND);
-    // Move all processes waiting for the pseudoclock back to the ready queue
-    while(!emptyProcQ(&pseudoclock_blocked_list)) {
-        pcb_PTR toUnblock = removeProcQ(&pseudoclock_blocked_list);
-        waiting_count--;
-        insertProcQ(&ready_queue, toUnblock);
-    }
-    if(current_process == NULL)
-        schedule();
-    else
-        LDST(currentState);
+void preemptProcess() {
+    saveState(current_process);
+    chargeTime(current_process);
+    readyProcess(current_process);
+    current_process = NULL;
+    schedule();
 }
 
 /**
@@ -185,23 +283,30 @@ void ITInterruptHandler() {
  */
 pcb_PTR termDevInterruptHandler(unsigned int *devStatusReg, unsigned int line, unsigned int dev) {
     termreg_t *devReg = (termreg_t *)getDevReg(line, dev);
-    unsigned short int selector;
+    unsigned int transmStatus = devReg->transm_status & TERMSTATMASK;
 
-    // Check for transmit status
-    if((devReg->transm_status & 0xFF) == OKCHARTRANS) {
+    // Check for transmit status, completed or failed: the transmitter is served first
+    if(transmStatus != READY && transmStatus != BUSY) {
         *devStatusReg = devReg->transm_status;
         devReg->transm_command = ACK;
-        selector = 0;
+
+        // The transmitter queue starts its next command
+        return deviceCompleted(((line - 3) * MAXDEV) + dev, *devStatusReg);
     }
-    // Check for receive status
-    else if((devReg->recv_status & 0xFF) == OKCHARTRANS) {
-        *devStatusReg = devReg->recv_status;
-        devReg->recv_command = ACK;
-        selector = 1;
+
+    // Otherwise the interrupt comes from the receiver
+    *devStatusReg = devReg->recv_status;
+    devReg->recv_command = ACK;
+
+    // Nobody asked for this character with DOIO: keep it in the receive buffer
+    if(emptyProcQ(&terminal_blocked_list[1][dev])) {
+        termReceive(dev, *devStatusReg);
+        return NULL;
     }
+    // Keep receiving once the character is handed to the waiting process
+    devReg->recv_command = RECEIVECHAR;
 
-    // Use selector to determine whether to unblock the process from the transmitter or receiver queue
-    return removeProcQ(&terminal_blocked_list[selector][dev]);
+    return removeProcQ(&terminal_blocked_list[1][dev]);
 }
 
 /**
@@ -219,6 +324,6 @@ pcb_PTR extDevInterruptHandler(unsigned int *devStatusReg, unsigned int line, un
     *devStatusReg = devReg->status;
     devReg->command = ACK;
 
-    // Unblock the process waiting for this external device
-    return removeProcQ(&external_blocked_list[(line - 3)][dev]);
+    // Unblock the process waiting for this external device, and start the next command
+    return deviceCompleted(((line - 3) * MAXDEV) + dev, *devStatusReg);
 }
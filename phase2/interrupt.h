@@ -10,18 +10,25 @@
 #include "../headers/types.h"
 #include <umps/arch.h>
 
-// types of interrupt
-unsigned int interruptConsts[] = { INTPROCINTERRUPT, LOCALTIMERINT, TIMERINTERRUPT, DISKINTERRUPT, FLASHINTERRUPT, NETWORKINTERRUPT, PRINTINTERRUPT, TERMINTERRUPT };
-// instances of device
-unsigned int deviceConsts[] = { DEV0ON, DEV1ON, DEV2ON, DEV3ON, DEV4ON, DEV5ON, DEV6ON, DEV7ON };
+// nesting level of the interrupt handler of processor 0 (0: not nested)
+int nest_level;
+// state of the interrupted process, saved while a nested interrupt may overwrite the BIOS data page
+state_t nest_saved_state;
+int nest_state_saved;
+// the PLT expired during a nested interrupt
+int nest_plt_expired;
+// index of the lowest bit set in every nibble (0 has none)
+unsigned char lowestBitInNibble[] = { 0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
 
 void interruptHandler();
 memaddr *getDevReg(unsigned int intLine, unsigned int devIntLine);
-unsigned short int intLineActive(unsigned short int line);
-unsigned short int intPendingInLine(unsigned int causeReg, unsigned short int line);
-unsigned short int intPendingOnDev(unsigned int *intLaneMapped, unsigned int dev);
+unsigned int firstSetBit(unsigned int bits);
+void devInterruptHandler(unsigned int line, unsigned int dev);
+void completeIO(pcb_PTR toUnblock, unsigned int devStatusReg);
+void interruptWindow(unsigned int line);
+void nestedInterruptHandler();
 void PLTInterruptHandler();
-void ITInterruptHandler();
+void preemptProcess();
 pcb_PTR termDevInterruptHandler(unsigned int *devStatusReg, unsigned int line, unsigned int dev);
 pcb_PTR extDevInterruptHandler(unsigned int *devStatusReg, unsigned int line, unsigned int dev);
 
@@ -1,29 +1,85 @@
 #include "scheduler.h"
 
 #include "../phase1/headers/pcb.h"
+#include "stats.h"
 
 extern int process_count;
 extern int waiting_count;
 extern pcb_PTR current_process;
-extern struct list_head ready_queue;
+extern sched_group_t sched_groups[NGROUPS];
+extern unsigned int global_pass;
+extern struct list_head edf_queue;
+extern struct list_head edf_throttled_list;
+extern struct list_head boost_queue;
+extern int edf_utilization;
+extern cpu_t dispatch_tod;
+extern cpu_t kernel_entry_tod;
+extern latency_stats_t latency_stats;
+extern idle_task_t idle_tasks[MAXIDLETASKS];
+extern int idle_task_count;
+extern int amp_offloaded;
+extern void ampCollect();
+extern int isAMPEligible(pcb_t *p);
+extern void ampOffload(pcb_t *p);
+extern int isDead(pcb_t *p);
+extern int reapDead();
+extern struct list_head reap_list;
 
 /**
  * @brief Loads a process to be run, or blocks execution.
  */
 void schedule() {
-  // Dispatch the next process
-  current_process = removeProcQ(&ready_queue);
+  while (TRUE) {
+    // Take back the processes returned by the secondary processors
+    ampCollect();
+
+    // Start the new period of the throttled EDF processes
+    edfRelease();
+
+    // Dispatch the next process
+    current_process = nextProcess();
+
+    // The processes of a killed tree are dropped, the reaper frees them
+    while (current_process != NULL && isDead(current_process)) {
+      current_process = nextProcess();
+    }
+
+    // In AMP mode U-procs run on the secondary processors only
+    while (current_process != NULL && isAMPEligible(current_process)) {
+      ampOffload(current_process);
+      current_process = nextProcess();
+      while (current_process != NULL && isDead(current_process)) {
+        current_process = nextProcess();
+      }
+    }
+
+    if (current_process != NULL || list_empty(&reap_list)) break;
+
+    // The dead processes may be all that is left, or hold the only waits: free them, then choose again
+    while (!list_empty(&reap_list) && !(getCAUSE() & IDLEINTMASK)) {
+      reapDead();
+    }
+    if (!list_empty(&reap_list)) break;
+  }
 
   if (current_process != NULL) {
-    // Load the PLT 
-    setTIMER(TIMESLICE * (*((cpu_t *)TIMESCALEADDR)));
-    // Perform Load Processor State 
-    LDST(&current_process->p_s);
-  } else if (process_count == 1) {
-    // If only the SSI process is in the system, halt
+    runProcess(current_process, timeSlice(current_process) * (*((cpu_t *)TIMESCALEADDR)));
+  } else if (!list_empty(&reap_list)) {
+    // Reaping stopped by a pending interrupt: take it, the handler schedules again
+    setSTATUS(IECON | IMON);
+    WAIT();
+  } else if (process_count == SSISHARDS) {
+    // If only the SSI processes are in the system, halt
     HALT();
+  } else if (process_count > 0 && (amp_offloaded > 0 || !emptyProcQ(&edf_throttled_list))) {
+    // If processes are running elsewhere or waiting for their budget, wait and poll at every PLT tick
+    runIdleTasks();
+    setTIMER(TIMESLICE * (*((cpu_t *)TIMESCALEADDR)));
+    setSTATUS(IECON | IMON | TEBITON);
+    WAIT();
   } else if (process_count > 0 && waiting_count > 0) {
-    // If waiting for an interrupt, wait
+    // If waiting for an interrupt, do some background work, then wait
+    runIdleTasks();
     setSTATUS((IECON | IMON) & (~TEBITON));
     WAIT();
   } else if (process_count > 0 && waiting_count == 0) {
@@ -31,3 +87,488 @@ void schedule() {
     PANIC();
   }
 }
+
+/**
+ * @brief Loads the state of the process chosen to run.
+ *
+ * @param p pointer to the process, already set as current_process
+ * @param ticks value loaded into the PLT
+ */
+void runProcess(pcb_t *p, unsigned int ticks) {
+  // Account the time spent waiting in the ready queue and in the nucleus
+  recordLatency(&latency_stats.runqueue_wait, p->p_queueTOD);
+  recordLatency(&latency_stats.dispatch, kernel_entry_tod);
+  // Load the PLT
+  STCK(dispatch_tod);
+  setTIMER(ticks);
+  // Perform Load Processor State
+  LDST(&p->p_s);
+}
+
+/**
+ * @brief Checks if a process can receive a donated time slice.
+ *
+ * @param p pointer to the process to check
+ * @return 1 if it is waiting in a ready queue of processor 0, 0 otherwise
+ */
+int canDonate(pcb_t *p) {
+  if (isAMPEligible(p) || isDead(p)) return FALSE;
+  return isInList(&sched_groups[schedGroup(p)].g_ready, p) || isInList(&edf_queue, p) || isInList(&boost_queue, p);
+}
+
+/**
+ * @brief Checks if a preempted process would be chosen again by the scheduler.
+ * That is the case when no other process is ready, nothing can come back from the
+ * secondary processors or out of EDF throttling, and its own budget is not exhausted.
+ *
+ * @param p pointer to the running process, its time already charged
+ * @return 1 if it can resume from the BIOS data page without saving its state, 0 otherwise
+ */
+int canResumeInPlace(pcb_t *p) {
+  if (amp_offloaded > 0 || !emptyProcQ(&edf_throttled_list) || isDead(p)) return FALSE;
+  if (p->p_edfPeriod > 0 && p->p_edfRemaining == 0) return FALSE;
+  if (!emptyProcQ(&boost_queue) || !emptyProcQ(&edf_queue)) return FALSE;
+  for (int g = 0; g < NGROUPS; g++) {
+    if (!emptyProcQ(&sched_groups[g].g_ready)) return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * @brief Runs a ready process right away, on the time slice left by the previous one.
+ * The caller must have saved the donor and checked the target with canDonate.
+ *
+ * @param p pointer to the process receiving the slice
+ * @param ticks PLT ticks left to the donor
+ */
+void donateSlice(pcb_t *p, unsigned int ticks) {
+  outReadyQueues(p);
+  current_process = p;
+
+  // Never beyond the slice (or the EDF budget) the process would get on its own
+  unsigned int maxTicks = timeSlice(p) * (*((cpu_t *)TIMESCALEADDR));
+  if (ticks > maxTicks) ticks = maxTicks;
+
+  runProcess(p, ticks);
+}
+
+/**
+ * @brief Registers a background job run when no process is ready.
+ *
+ * @param task function performing one bounded step of the job
+ * @return OK if the task was registered, MSGNOGOOD if the table is full
+ */
+int registerIdleTask(idle_task_t task) {
+  if (idle_task_count == MAXIDLETASKS) return MSGNOGOOD;
+  idle_tasks[idle_task_count++] = task;
+  return OK;
+}
+
+/**
+ * @brief Runs the idle tasks, one step at a time and round robin, until none has work left.
+ * Interrupts are disabled, but the pending ones still show up in the Cause register:
+ * the loop stops as soon as one of them could make a process ready.
+ */
+void runIdleTasks() {
+  int workLeft = TRUE;
+  while (workLeft) {
+    workLeft = FALSE;
+    for (int i = 0; i < idle_task_count; i++) {
+      if (getCAUSE() & IDLEINTMASK) return;
+      if (idle_tasks[i]()) workLeft = TRUE;
+    }
+  }
+}
+
+/**
+ * @brief Removes the next process to run from the ready queues.
+ * Processes boosted by EDF waiters come first, then EDF processes, then
+ * processes boosted by best-effort waiters. Otherwise the best-effort group
+ * with the smallest pass is served (stride scheduling), FIFO among its processes.
+ *
+ * @return Pointer to the process, or NULL if no process is ready
+ */
+pcb_t *nextProcess() {
+  pcb_PTR boosted = headProcQ(&boost_queue);
+  if (boosted != NULL && boosted->p_prio >= PRIOEDF)
+    return removeProcQ(&boost_queue);
+
+  if (!emptyProcQ(&edf_queue))
+    return removeProcQ(&edf_queue);
+
+  if (boosted != NULL)
+    return removeProcQ(&boost_queue);
+
+  sched_group_t *chosen = NULL;
+  for (int g = 0; g < NGROUPS; g++) {
+    if (!emptyProcQ(&sched_groups[g].g_ready) &&
+        (chosen == NULL || (int) (sched_groups[g].g_pass - chosen->g_pass) < 0)) {
+      chosen = &sched_groups[g];
+    }
+  }
+  if (chosen == NULL) return NULL;
+
+  global_pass = chosen->g_pass;
+  return removeProcQ(&chosen->g_ready);
+}
+
+/**
+ * @brief Finds the scheduling group of a process.
+ *
+ * @param p pointer to the process
+ * @return The ASID of its support structure, or 0 if it has none
+ */
+int schedGroup(pcb_t *p) {
+  if (p->p_supportStruct == NULL) return 0;
+  int asid = p->p_supportStruct->sup_asid;
+  return (asid > 0 && asid < NGROUPS) ? asid : 0;
+}
+
+/**
+ * @brief Computes the time slice of a process.
+ *
+ * @param p pointer to the process to dispatch
+ * @return The time slice in microseconds: an EDF process never runs beyond its budget
+ */
+cpu_t timeSlice(pcb_t *p) {
+  if (p->p_edfPeriod > 0 && p->p_edfRemaining < TIMESLICE)
+    return p->p_edfRemaining;
+  return TIMESLICE;
+}
+
+/**
+ * @brief Inserts a process in the ready queue of its scheduling class.
+ *
+ * @param p pointer to the process to make ready
+ */
+void readyProcess(pcb_t *p) {
+  // A process holding up others runs at the priority it inherited from them
+  if (p->p_prio > basePriority(p)) {
+    pcb_PTR iter;
+    list_for_each_entry(iter, &boost_queue, p_list) {
+      if (p->p_prio > iter->p_prio) {
+        STCK(p->p_queueTOD);
+        list_add_tail(&p->p_list, &iter->p_list);
+        return;
+      }
+    }
+    insertProcQ(&boost_queue, p);
+    return;
+  }
+
+  if (p->p_edfPeriod == 0) {
+    sched_group_t *group = &sched_groups[schedGroup(p)];
+    // A group coming back from idle cannot claim the CPU time it did not use
+    if (emptyProcQ(&group->g_ready) && (int) (group->g_pass - global_pass) < 0) {
+      group->g_pass = global_pass;
+    }
+    insertProcQ(&group->g_ready, p);
+    return;
+  }
+
+  cpu_t now;
+  STCK(now);
+
+  // A process waking up after its deadline starts a new period
+  if (now >= p->p_edfDeadline) {
+    p->p_edfDeadline = now + p->p_edfPeriod;
+    p->p_edfRemaining = p->p_edfBudget;
+  }
+
+  // A process without budget waits for its next period
+  if (p->p_edfRemaining <= 0) {
+    insertProcQ(&edf_throttled_list, p);
+    return;
+  }
+
+  // Keep the EDF queue ordered by deadline, FIFO among equal deadlines
+  pcb_PTR iter;
+  list_for_each_entry(iter, &edf_queue, p_list) {
+    if (p->p_edfDeadline < iter->p_edfDeadline) {
+      STCK(p->p_queueTOD);
+      list_add_tail(&p->p_list, &iter->p_list);
+      return;
+    }
+  }
+  insertProcQ(&edf_queue, p);
+}
+
+/**
+ * @brief Checks if a process is in one of the ready queues.
+ *
+ * @param p pointer to the process to check
+ * @return 1 if it is ready (or throttled), 0 otherwise
+ */
+int isReady(pcb_t *p) {
+  return isInList(&sched_groups[schedGroup(p)].g_ready, p) || isInList(&edf_queue, p) ||
+         isInList(&edf_throttled_list, p) || isInList(&boost_queue, p);
+}
+
+/**
+ * @brief Removes a process from the ready queues.
+ *
+ * @param p pointer to the process to remove
+ * @return Pointer to the removed process, or NULL if it was not ready
+ */
+pcb_t *outReadyQueues(pcb_t *p) {
+  if (outProcQ(&sched_groups[schedGroup(p)].g_ready, p) != NULL) return p;
+  if (outProcQ(&edf_queue, p) != NULL) return p;
+  if (outProcQ(&boost_queue, p) != NULL) return p;
+  return outProcQ(&edf_throttled_list, p);
+}
+
+/**
+ * @brief Moves the throttled EDF processes whose new period has started back to the EDF queue.
+ */
+void edfRelease() {
+  cpu_t now;
+  STCK(now);
+
+  struct list_head *pos = edf_throttled_list.next;
+  while (pos != &edf_throttled_list) {
+    pcb_PTR p = container_of(pos, pcb_t, p_list);
+    pos = pos->next;
+    if (now >= p->p_edfDeadline) {
+      list_del(&p->p_list);
+      readyProcess(p);
+    }
+  }
+}
+
+/**
+ * @brief Charges the time spent running since the last dispatch to a process.
+ * The time is measured on the TOD, whatever slice the PLT was loaded with
+ * (EDF budget, donated slice, in-place resume).
+ *
+ * @param p pointer to the process leaving the CPU
+ */
+void chargeTime(pcb_t *p) {
+  cpu_t now;
+  STCK(now);
+  chargeElapsed(p, now - dispatch_tod);
+}
+
+/**
+ * @brief Charges a run of the given length to a process and adds it to its processor time.
+ * An EDF process consumes its budget, a best-effort process advances the pass
+ * of its group by one stride every STRIDEUNIT microseconds.
+ * The time a server spends on a request is billed to the client instead,
+ * and the stride is charged to the group of the client.
+ *
+ * @param p pointer to the process that ran
+ * @param elapsed microseconds it ran for
+ */
+void chargeElapsed(pcb_t *p, cpu_t elapsed) {
+  p->p_time += elapsed;
+
+  pcb_PTR client = billedClient(p);
+  if (client != NULL) client->p_billedTime += elapsed;
+
+  if (p->p_edfPeriod > 0) {
+    p->p_edfRemaining -= elapsed;
+    if (p->p_edfRemaining < 0) p->p_edfRemaining = 0;
+  } else {
+    sched_group_t *group = &sched_groups[schedGroup(client != NULL ? client : p)];
+    // Short runs add up: the part of a stride left over is charged with the next run
+    unsigned int used = group->g_residue + (unsigned int) elapsed;
+    group->g_pass += (STRIDE1 / group->g_weight) * (used / STRIDEUNIT);
+    group->g_residue = used % STRIDEUNIT;
+  }
+}
+
+/**
+ * @brief Finds the client a server is working for.
+ *
+ * @param p pointer to the process
+ * @return The client, or NULL if p is not serving a request or the client is gone
+ */
+pcb_t *billedClient(pcb_t *p) {
+  pcb_PTR client = p->p_billTo;
+  if (!p->p_server || client == NULL || client == p) return NULL;
+  if (isInPCBFree_h(client) || client->p_pid != p->p_billPid) return NULL;
+  return client;
+}
+
+/**
+ * @brief Starts billing the work of a server to a new client.
+ * The time spent so far goes to the previous client, then the count restarts.
+ *
+ * @param server pointer to the running server
+ * @param client pointer to the sender of the request just received
+ */
+void billTo(pcb_t *server, pcb_t *client) {
+  chargeTime(server);
+  STCK(dispatch_tod);
+  server->p_billTo = client;
+  server->p_billPid = client->p_pid;
+}
+
+/**
+ * @brief Changes the weight of a scheduling group.
+ *
+ * @param asid group to configure
+ * @param weight new weight of the group
+ * @return OK if the weight was changed, MSGNOGOOD if the arguments are out of range
+ */
+int setGroupWeight(int asid, int weight) {
+  if (asid < 0 || asid >= NGROUPS || weight < 1 || weight > MAXWEIGHT) return MSGNOGOOD;
+  sched_groups[asid].g_weight = weight;
+  return OK;
+}
+
+/**
+ * @brief Checks if a ready EDF process must preempt the running process.
+ *
+ * @param p pointer to the running process
+ * @return 1 if the head of the EDF queue has an earlier deadline, 0 otherwise
+ */
+int edfPreempts(pcb_t *p) {
+  pcb_PTR head = headProcQ(&edf_queue);
+  if (head == NULL || p->p_prio >= PRIOEDF) return FALSE;
+  return p->p_edfPeriod == 0 || head->p_edfDeadline < p->p_edfDeadline;
+}
+
+/**
+ * @brief Computes the utilization of an EDF reservation.
+ * budget * 1000 does not fit in 32 bits beyond about 4.3 seconds: for such budgets
+ * the period is scaled down instead, the error stays under one per mille.
+ *
+ * @param budget CPU budget per period in microseconds, positive and not above the period
+ * @param period period in microseconds
+ * @return The utilization in per mille, at least 1
+ */
+static int edfUtilization(cpu_t budget, cpu_t period) {
+  unsigned int b = (unsigned int) budget;
+  unsigned int per = (unsigned int) period;
+  unsigned int utilization = b <= 0xFFFFFFFFU / 1000 ? (b * 1000) / per : b / (per / 1000);
+  return utilization == 0 ? 1 : (int) utilization;
+}
+
+/**
+ * @brief Moves a process to (or out of) the EDF class, performing admission control.
+ * The total utilization (budget / period) of the EDF class is kept below EDFMAXUTIL,
+ * so best-effort processes (and the SSI among them) never starve.
+ *
+ * @param p pointer to the process
+ * @param period period in microseconds, 0 to go back to best-effort
+ * @param budget CPU budget per period in microseconds
+ * @return OK if the process was admitted, EDFREJECTED otherwise (its reservation, if any, is left as it is)
+ */
+int edfAdmit(pcb_t *p, cpu_t period, cpu_t budget) {
+  if (period == 0) {
+    edfLeave(p);
+    return OK;
+  }
+  if (period < 0 || budget <= 0 || budget > period) return EDFREJECTED;
+
+  // A rejected change keeps the reservation the process already has
+  int utilization = edfUtilization(budget, period);
+  int reserved = p->p_edfPeriod > 0 ? edfUtilization(p->p_edfBudget, p->p_edfPeriod) : 0;
+  if (edf_utilization - reserved + utilization > EDFMAXUTIL) return EDFREJECTED;
+
+  // Release the utilization reserved so far
+  edfLeave(p);
+
+  cpu_t now;
+  STCK(now);
+  edf_utilization += utilization;
+  p->p_edfPeriod = period;
+  p->p_edfBudget = budget;
+  p->p_edfRemaining = budget;
+  p->p_edfDeadline = now + period;
+  return OK;
+}
+
+/**
+ * @brief Moves a process back to the best-effort class, releasing its EDF utilization.
+ *
+ * @param p pointer to the process
+ */
+void edfLeave(pcb_t *p) {
+  if (p->p_edfPeriod == 0) return;
+
+  edf_utilization -= edfUtilization(p->p_edfBudget, p->p_edfPeriod);
+  p->p_edfPeriod = 0;
+  p->p_edfBudget = 0;
+  p->p_edfRemaining = 0;
+  p->p_edfDeadline = 0;
+}
+
+/**
+ * @brief Computes the priority a process has on its own.
+ *
+ * @param p pointer to the process
+ * @return PRIOEDF for an EDF process, PRIONORMAL otherwise
+ */
+int basePriority(pcb_t *p) {
+  return p->p_edfPeriod > 0 ? PRIOEDF : PRIONORMAL;
+}
+
+/**
+ * @brief Records that a process is blocked receiving from another one, which inherits its priority.
+ *
+ * @param waiter pointer to the blocked process
+ * @param holder pointer to the process it is waiting on
+ */
+void waitOn(pcb_t *waiter, pcb_t *holder) {
+  stopWaiting(waiter);
+  waiter->p_waitingOn = holder;
+  list_add_tail(&waiter->p_waitLink, &holder->p_waiters);
+  inheritPriority(holder);
+}
+
+/**
+ * @brief Removes the waiting edge of a process, dropping the priority its holder inherited from it.
+ *
+ * @param waiter pointer to the process no longer waiting
+ */
+void stopWaiting(pcb_t *waiter) {
+  pcb_PTR holder = waiter->p_waitingOn;
+  if (holder == NULL) return;
+  list_del(&waiter->p_waitLink);
+  INIT_LIST_HEAD(&waiter->p_waitLink);
+  waiter->p_waitingOn = NULL;
+  inheritPriority(holder);
+}
+
+/**
+ * @brief Detaches all the waiters of a process that is going away.
+ *
+ * @param holder pointer to the process being destroyed
+ */
+void dropWaiters(pcb_t *holder) {
+  stopWaiting(holder);
+  while (!list_empty(&holder->p_waiters)) {
+    pcb_PTR waiter = container_of(holder->p_waiters.next, pcb_t, p_waitLink);
+    list_del(&waiter->p_waitLink);
+    INIT_LIST_HEAD(&waiter->p_waitLink);
+    waiter->p_waitingOn = NULL;
+  }
+  holder->p_prio = PRIONORMAL;
+}
+
+/**
+ * @brief Recomputes the inherited priority of a process, and of the chain of processes it waits on.
+ * Every waiter lends at least PRIOBOOST, and its own priority if higher.
+ * A ready process whose priority changed is moved to the right ready queue.
+ *
+ * @param p pointer to the first process of the chain
+ */
+void inheritPriority(pcb_t *p) {
+  while (p != NULL) {
+    int prio = PRIONORMAL;
+    pcb_PTR waiter;
+    list_for_each_entry(waiter, &p->p_waiters, p_waitLink) {
+      int lent = basePriority(waiter) > waiter->p_prio ? basePriority(waiter) : waiter->p_prio;
+      if (lent < PRIOBOOST) lent = PRIOBOOST;
+      if (lent > prio) prio = lent;
+    }
+
+    // Nothing changes further along the chain
+    if (prio == p->p_prio) return;
+    p->p_prio = prio;
+
+    if (outReadyQueues(p) != NULL) readyProcess(p);
+    p = p->p_waitingOn;
+  }
+}
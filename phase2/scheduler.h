@@ -10,5 +10,31 @@
 #include "../headers/types.h"
 
 void schedule();
+void runProcess(pcb_t *p, unsigned int ticks);
+int canDonate(pcb_t *p);
+int canResumeInPlace(pcb_t *p);
+void donateSlice(pcb_t *p, unsigned int ticks);
+int registerIdleTask(idle_task_t task);
+void runIdleTasks();
+pcb_t *nextProcess();
+cpu_t timeSlice(pcb_t *p);
+void readyProcess(pcb_t *p);
+int isReady(pcb_t *p);
+pcb_t *outReadyQueues(pcb_t *p);
+void edfRelease();
+void chargeTime(pcb_t *p);
+void chargeElapsed(pcb_t *p, cpu_t elapsed);
+pcb_t *billedClient(pcb_t *p);
+void billTo(pcb_t *server, pcb_t *client);
+int schedGroup(pcb_t *p);
+int setGroupWeight(int asid, int weight);
+int edfPreempts(pcb_t *p);
+int edfAdmit(pcb_t *p, cpu_t period, cpu_t budget);
+void edfLeave(pcb_t *p);
+int basePriority(pcb_t *p);
+void waitOn(pcb_t *waiter, pcb_t *holder);
+void stopWaiting(pcb_t *waiter);
+void dropWaiters(pcb_t *holder);
+void inheritPriority(pcb_t *p);
 
-#endif
\ No newline at end of file
+#endif
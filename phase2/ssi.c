@@ -1,15 +1,25 @@
 #include "ssi.h"
 
 #include "../phase1/headers/pcb.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "timer.h"
+#include "device.h"
+#include "disk.h"
 
 extern int process_count;
 extern int waiting_count;
 extern pcb_PTR current_process;
-extern struct list_head ready_queue;
 extern struct list_head external_blocked_list[4][MAXDEV];
-extern struct list_head pseudoclock_blocked_list;
 extern struct list_head terminal_blocked_list[2][MAXDEV];
+extern struct list_head term_readers[MAXDEV];
 extern void copyRegisters(state_t *dest, state_t *src);
+extern int ampRevoke(pcb_t *p);
+extern int outWaitTable(pcb_t *p);
+extern latency_stats_t latency_stats;
+extern spawn_template_t spawn_templates[MAXTEMPLATES];
+extern int template_count;
+extern struct list_head reap_list;
 
 /**
  * @brief Handles a request received from a process.
@@ -19,64 +29,205 @@ void SSIHandler() {
   while (TRUE) {
     ssi_payload_PTR p_payload;
     pcb_PTR sender = (pcb_PTR) SYSCALL(RECEIVEMESSAGE, ANYMESSAGE, (unsigned int) &p_payload, 0);
-    unsigned int response = 0;
-
-    // Perform the requested service based on the service code
-    switch (p_payload->service_code) {
-      case CREATEPROCESS:
-        // Create a new process
-        response = createProcess((ssi_create_process_PTR) p_payload->arg, sender);
-        break;
-      case TERMPROCESS:
-        // Terminate an existing process
-        if (p_payload->arg == NULL) {
-          terminateProcess(sender);  // Terminate the sender itself
-        } else {
-          terminateProcess((pcb_PTR) p_payload->arg);  // Terminate the specified process
-        }
-        break;
-      case DOIO:
-        // Perform I/O operation
-        blockForDevice((ssi_do_io_PTR) p_payload->arg, sender);
-        break;
-      case GETTIME:
-        // Return the accumulated processor time
-        response = (unsigned int) sender->p_time;
-        break;
-      case CLOCKWAIT:
-        // Block the process for the pseudoclock
-        insertProcQ(&pseudoclock_blocked_list, sender);
-        waiting_count++;
-        break;
-      case GETSUPPORTPTR:
-        // Return the support structure of the process
-        response = (unsigned int) sender->p_supportStruct;
-        break;
-      case GETPROCESSID:
-        // Return the process ID of the sender or its parent
-        if (((unsigned int) p_payload->arg) == 0) {
-          response = sender->p_pid;
+    int reply = TRUE;
+    int pid = sender->p_pid;
+    cpu_t received;
+    STCK(received);
+
+    // The other instances and the interrupt handler share the nucleus state: serve the request atomically
+    setSTATUS(getSTATUS() & (~IECON));
+    unsigned int response = handleRequest(p_payload, sender, &reply);
+    setSTATUS(getSTATUS() | IECON);
+
+    // Account the time spent serving the request
+    recordLatency(&latency_stats.ssi_service, received);
+    // A terminated sender's PCB may already belong to a new process
+    if (reply && !senderGone(sender, pid)) {
+      SYSCALL(SENDMESSAGE, (unsigned int) sender, response, 0);
+    }
+  }
+}
+
+/**
+ * @brief Performs the service of a single request.
+ * @param p_payload The request.
+ * @param sender The requesting process.
+ * @param reply Set to FALSE if the response is sent later, on the completion of the request.
+ * @return The response to the request.
+ */
+static unsigned int handleRequest(ssi_payload_t *p_payload, pcb_t *sender, int *reply) {
+  unsigned int response = 0;
+
+  // Perform the requested service based on the service code
+  switch (p_payload->service_code) {
+    case CREATEPROCESS:
+      // Create a new process
+      response = createProcess((ssi_create_process_PTR) p_payload->arg, sender);
+      break;
+    case REGTEMPLATE:
+      // Register a spawn template
+      response = registerTemplate((ssi_create_process_PTR) p_payload->arg);
+      break;
+    case KILLPROCESS:
+      // Kill an existing process, the reaper frees it later
+      if (p_payload->arg == NULL) {
+        killTree(sender);  // Kill the sender itself
+      } else {
+        killTree((pcb_PTR) p_payload->arg);  // Kill the specified process
+      }
+      break;
+    case SPAWN:
+      // Create several processes from a template
+      response = spawnProcesses((ssi_spawn_PTR) p_payload->arg, sender);
+      break;
+    case TERMPROCESS:
+      // Terminate an existing process
+      if (p_payload->arg == NULL) {
+        terminateTree(sender, TRUE);  // Terminate the sender itself
+      } else {
+        terminateTree((pcb_PTR) p_payload->arg, TRUE);  // Terminate the specified process
+      }
+      break;
+    case DOIO:
+      // Perform I/O operation, the interrupt handler answers on completion
+      if (blockForDevice((ssi_do_io_PTR) p_payload->arg, sender)) {
+        *reply = FALSE;
+      } else {
+        response = MSGNOGOOD;
+      }
+      break;
+    case ASYNCDOIO:
+      // Start an I/O operation and return its ticket right away
+      response = (unsigned int) asyncDoIO((ssi_do_io_PTR) p_payload->arg, sender);
+      break;
+    case DISKSTATS:
+      // Return the seek statistics of a disk and the average seek distance saved per request
+      response = (unsigned int) copyDiskStats((disk_stats_PTR) p_payload->arg);
+      break;
+    case GETTIME:
+      // Return the accumulated processor time
+      response = (unsigned int) sender->p_time;
+      break;
+    case CLOCKWAIT:
+      // Block the process until the next pseudoclock tick
+      sleepClockTick(sender);
+      break;
+    case SLEEP:
+      // Block the process for the given number of microseconds
+      sleepFor(sender, (unsigned int) p_payload->arg);
+      break;
+    case GETSUPPORTPTR:
+      // Return the support structure of the process
+      response = (unsigned int) sender->p_supportStruct;
+      break;
+    case GETPROCESSID:
+      // Return the process ID of the sender or its parent
+      if (((unsigned int) p_payload->arg) == 0) {
+        response = sender->p_pid;
+      } else {
+        if (sender->p_parent == NULL) {
+          response = 0;  // Return 0 if no parent exists
         } else {
-          if (sender->p_parent == NULL) {
-            response = 0;  // Return 0 if no parent exists
-          } else {
-            response = sender->p_parent->p_pid;  // Return the parent's process ID
-          }
+          response = sender->p_parent->p_pid;  // Return the parent's process ID
         }
-        break;
-      case ENDIO:
-        // Terminate the IO operation
-        response = sender->p_s.reg_v0;
-        break;
-      default:
-        // Invalid service code, terminate the requesting process and its progeny
-        terminateProcess(sender);
-        break;
+      }
+      break;
+    case SETEDF:
+      // Move the sender to the EDF class, or back to best-effort
+      if (p_payload->arg == NULL) {
+        response = (unsigned int) MSGNOGOOD;
+      } else {
+        response = edfAdmit(sender, ((ssi_edf_PTR) p_payload->arg)->period, ((ssi_edf_PTR) p_payload->arg)->budget);
+      }
+      break;
+    case SETWEIGHT:
+      // Change the CPU share of a scheduling group: a process with a support structure
+      // may only change its own group, the system processes any of them
+      if (p_payload->arg == NULL) {
+        response = (unsigned int) MSGNOGOOD;
+      } else if (sender->p_supportStruct != NULL && ((ssi_weight_PTR) p_payload->arg)->asid != schedGroup(sender)) {
+        response = (unsigned int) MSGNOGOOD;
+      } else {
+        response = setGroupWeight(((ssi_weight_PTR) p_payload->arg)->asid, ((ssi_weight_PTR) p_payload->arg)->weight);
+      }
+      break;
+    case REGSERVER:
+      // Bill the CPU time the sender spends on requests to the senders of the requests
+      sender->p_server = TRUE;
+      break;
+    case GETBILLEDTIME:
+      // Return the CPU time servers spent on behalf of the sender or of the given process
+      if (p_payload->arg == NULL) {
+        response = (unsigned int) sender->p_billedTime;
+      } else if (isInPCBFree_h((pcb_PTR) p_payload->arg)) {
+        response = (unsigned int) NOPROC;
+      } else {
+        response = (unsigned int) ((pcb_PTR) p_payload->arg)->p_billedTime;
+      }
+      break;
+    case GETLATENCY:
+      // Return a snapshot of the latency histograms
+      if (p_payload->arg == NULL) {
+        response = (unsigned int) MSGNOGOOD;
+      } else {
+        copyLatencyStats((latency_stats_PTR) p_payload->arg);
+      }
+      break;
+    case BATCH:
+      // Serve several requests with a single message
+      response = handleBatch((ssi_batch_PTR) p_payload->arg, sender, reply);
+      break;
+    case ENDIO:
+      // Terminate the IO operation
+      response = sender->p_s.reg_v0;
+      break;
+    default:
+      // Invalid service code, terminate the requesting process and its progeny
+      terminateTree(sender, TRUE);
+      break;
+  }
+  return response;
+}
+
+/**
+ * @brief Checks if the sender of a request has been terminated or killed while it was served.
+ * The interrupt windows of a termination let the other SSI instances run, so its PCB
+ * may have been freed and allocated again: the PID tells.
+ * @param sender The requesting process.
+ * @param pid The PID of the sender when the request was received.
+ * @return TRUE if the sender is gone or dead, FALSE otherwise.
+ */
+static int senderGone(pcb_t *sender, int pid) {
+  return isInPCBFree_h(sender) || sender->p_pid != pid || isDead(sender);
+}
+
+/**
+ * @brief Serves the requests of a batch in order, storing the response of each one.
+ * A request that makes the sender wait (DOIO, CLOCKWAIT, SLEEP) or terminates or kills it ends the batch,
+ * the requests after it are not served. A batch inside a batch is refused with MSGNOGOOD.
+ * @param batch The requests and the array for their responses.
+ * @param sender The requesting process.
+ * @param reply Set to FALSE if a DOIO ended the batch: its completion is the response.
+ * @return The number of requests served.
+ */
+static unsigned int handleBatch(ssi_batch_t *batch, pcb_t *sender, int *reply) {
+  int served = 0;
+  int pid = sender->p_pid;
+
+  while (served < batch->count) {
+    ssi_payload_t *request = &batch->requests[served];
+    if (request->service_code == BATCH) {
+      batch->results[served] = MSGNOGOOD;
+    } else {
+      batch->results[served] = handleRequest(request, sender, reply);
     }
-    if (p_payload->service_code != DOIO) {
-      SYSCALL(SENDMESSAGE, (unsigned int) sender, response, 0);
+    served++;
+
+    if (!*reply || senderGone(sender, pid) || request->service_code == CLOCKWAIT || request->service_code == SLEEP) {
+      break;
     }
   }
+  return served;
 }
 
 /**
@@ -86,44 +237,185 @@ void SSIHandler() {
  * @return Pointer to the created process, NOPROC otherwise.
  */
 static unsigned int createProcess(ssi_create_process_t *arg, pcb_t *sender) {
-  pcb_PTR p = allocPcb();  // Allocate a new PCB for the process
+  pcb_PTR p = newPcb();  // Allocate a new PCB for the process
   if (p == NULL) {
     return (unsigned int) NOPROC;  // Return NOPROC if allocation fails
   } else {
     copyRegisters(&p->p_s, arg->state);  // Copy the state from the argument to the new process
     if (arg->support != NULL) p->p_supportStruct = arg->support;  // Set the support structure if provided
-    insertChild(sender, p);  // Insert the new process as a child of the sender
-    insertProcQ(&ready_queue, p);  // Insert the process into the ready queue
-    process_count++;  // Increment the process count
+    startChild(p, sender);
     return (unsigned int) p;  // Return the process pointer
   }
 }
 
+/**
+ * @brief Allocates a PCB, reaping the killed processes right away if none is free.
+ * @return The new PCB, NULL if all of them belong to live processes.
+ */
+static pcb_t *newPcb() {
+  pcb_t *p = allocPcb();
+  while (p == NULL && !list_empty(&reap_list)) {
+    reapDead();
+    p = allocPcb();
+  }
+  return p;
+}
+
+/**
+ * @brief Makes a newly allocated process a child of the requesting process and inserts it into the ready queue.
+ * @param p The new process, its state already set.
+ * @param sender The requesting process.
+ */
+static void startChild(pcb_t *p, pcb_t *sender) {
+  insertChild(sender, p);  // Insert the new process as a child of the sender
+  readyProcess(p);  // Insert the process into the ready queue
+  process_count++;  // Increment the process count
+}
+
+/**
+ * @brief Registers a prebuilt state and support structure to spawn processes from.
+ * The state is copied into the nucleus, the caller can reuse its own copy.
+ * @param arg Structure containing the state and optional support structure of the template.
+ * @return The identifier of the template, MSGNOGOOD if there is no room for it.
+ */
+static unsigned int registerTemplate(ssi_create_process_t *arg) {
+  if (template_count == MAXTEMPLATES) return (unsigned int) MSGNOGOOD;
+
+  spawn_template_t *template = &spawn_templates[template_count];
+  copyRegisters(&template->state, arg->state);
+  template->support = arg->support;
+  return (unsigned int) template_count++;
+}
+
+/**
+ * @brief Creates several children of the requesting process from a template.
+ * Each process gets the state and support structure of the template, with its own
+ * stack pointer, ASID and support structure when the overrides set them.
+ * @param arg The template, the number of processes, the overrides and the array for the processes.
+ * @param sender The requesting process.
+ * @return The number of processes created, less than requested if the PCBs run out,
+ *         MSGNOGOOD if the template does not exist or an override ASID is not 1..UPROCMAX.
+ */
+static unsigned int spawnProcesses(ssi_spawn_t *arg, pcb_t *sender) {
+  if (arg->id < 0 || arg->id >= template_count) return (unsigned int) MSGNOGOOD;
+  // Check every override first: a bad ASID spawns nothing
+  if (arg->overrides != NULL) {
+    for (int i = 0; i < arg->count; i++) {
+      if (arg->overrides[i].asid > UPROCMAX) return (unsigned int) MSGNOGOOD;
+    }
+  }
+
+  spawn_template_t *template = &spawn_templates[arg->id];
+  int spawned = 0;
+  while (spawned < arg->count) {
+    pcb_PTR p = newPcb();
+    if (p == NULL) break;
+
+    copyRegisters(&p->p_s, &template->state);
+    p->p_supportStruct = template->support;
+    if (arg->overrides != NULL) {
+      ssi_spawn_override_t *override = &arg->overrides[spawned];
+      if (override->sp != 0) p->p_s.reg_sp = override->sp;
+      if (override->asid != 0) p->p_s.entry_hi = (p->p_s.entry_hi & ~GETASID) | ((override->asid << ASIDSHIFT) & GETASID);
+      if (override->support != NULL) p->p_supportStruct = override->support;
+    }
+    startChild(p, sender);
+    arg->spawned[spawned++] = p;
+  }
+  return (unsigned int) spawned;
+}
+
 /**
  * @brief Terminates a process and all of its progeny (children).
+ * If its tree is already being terminated or killed, the process is left to that termination:
+ * the scheduler never dispatches it again and its PCB is freed with the rest of the tree.
  * @param p The process to terminate.
  */
 void terminateProcess(pcb_t *p) {
-  outChild(p);  // Remove the process from the parent’s children list
-  terminateProgeny(p);  // Recursively terminate the progeny
-  destroyProcess(p);  // Destroy the process and free resources
+  terminateTree(p, FALSE);
 }
 
 /**
- * @brief Terminates all the children of a process recursively.
- * @param p The process whose children are to be terminated.
+ * @brief Terminates a process and its progeny one leaf at a time.
+ * The tree is detached first, so the other SSI instances can no longer reach it through
+ * its ancestors, and its root is marked so that nobody else starts terminating it.
+ * An SSI instance opens an interrupt window after each process destroyed: a big tree
+ * does not hold up the I/O completions and the requests served by the other instances.
+ * @param p The process to terminate.
+ * @param preemptible TRUE when called by an SSI instance, FALSE in the nucleus.
  */
-void terminateProgeny(pcb_t *p) {
+static void terminateTree(pcb_t *p, int preemptible) {
+  if (isInPCBFree_h(p)) return;
+  // Somebody else is freeing the tree (an SSI instance between two windows, or the reaper):
+  // the process stays in it, out of every queue, until its turn comes
+  if (isDead(p)) return;
+  p->p_dying = TRUE;
+  outChild(p);  // Remove the process from the parent’s children list
+
   while (!emptyChild(p)) {
-    // Remove the first child
-    pcb_t *child = removeChild(p);
-    // If the child was removed successfully, terminate its progeny recursively
-    if (child != NULL) {
-      terminateProgeny(child);
-      // After terminating the children, destroy the child process
-      destroyProcess(child);
+    // The tree may have changed during the window: look for a leaf from the root again
+    pcb_t *leaf = p;
+    while (!emptyChild(leaf)) {
+      leaf = container_of(list_next(&leaf->p_child), pcb_t, p_sib);
+    }
+    outChild(leaf);
+    destroyProcess(leaf);
+
+    if (preemptible) {
+      setSTATUS(getSTATUS() | IECON);
+      setSTATUS(getSTATUS() & (~IECON));
     }
   }
+  destroyProcess(p);  // Destroy the process and free resources
+}
+
+/**
+ * @brief Kills a process and all of its progeny without freeing them.
+ * Only the root is touched: it is detached from its parent, marked dead and handed to
+ * the reaper, so the request takes the same time whatever the size of the tree.
+ * The whole tree is dead from now on: it is never dispatched again and the messages
+ * sent to it are refused.
+ * @param p The process to kill.
+ */
+static void killTree(pcb_t *p) {
+  if (isInPCBFree_h(p) || isDead(p)) return;
+  p->p_dying = TRUE;
+  outChild(p);  // Remove the process from the parent’s children list
+  list_add_tail(&p->p_sib, &reap_list);
+}
+
+/**
+ * @brief Checks if a process belongs to a tree being terminated or killed.
+ * @param p The process to check, not a free PCB.
+ * @return 1 if it or one of its ancestors is marked, 0 otherwise.
+ */
+int isDead(pcb_t *p) {
+  for (; p != NULL; p = p->p_parent) {
+    if (p->p_dying) return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ * @brief Frees one process of the trees killed with KILLPROCESS, a leaf of the oldest one.
+ * Registered as an idle task; the scheduler and newPcb also call it when they cannot wait.
+ * @return 1 while dead processes are left, 0 otherwise.
+ */
+int reapDead() {
+  if (list_empty(&reap_list)) return FALSE;
+
+  pcb_t *root = container_of(list_next(&reap_list), pcb_t, p_sib);
+  pcb_t *leaf = root;
+  while (!emptyChild(leaf)) {
+    leaf = container_of(list_next(&leaf->p_child), pcb_t, p_sib);
+  }
+  if (leaf == root) {
+    list_del(&root->p_sib);  // The whole tree is gone
+  } else {
+    outChild(leaf);
+  }
+  destroyProcess(leaf);
+  return !list_empty(&reap_list);
 }
 
 /**
@@ -132,12 +424,12 @@ void terminateProgeny(pcb_t *p) {
  */
 void destroyProcess(pcb_t *p) {
   if (!isInPCBFree_h(p)) {
-    // Look for the process in the ready queue
-    if (outProcQ(&ready_queue, p) == NULL) {
-      // If not in the ready queue, check the pseudoclock blocked list
+    // Look for the process in the ready queue or on the secondary processors
+    if (outReadyQueues(p) == NULL && !ampRevoke(p) && !outWaitTable(p)) {
+      // If not in the ready queue, check the timer wheel
       int found = FALSE;
-      if (outProcQ(&pseudoclock_blocked_list, p) == NULL) {
-        // If not in pseudoclock, check other blocked lists (e.g., devices)
+      if (!cancelSleep(p)) {
+        // If not sleeping, check other blocked lists (e.g., devices)
         for (int i = 0; i < MAXDEV && found == FALSE; i++) {
           if (outProcQ(&external_blocked_list[0][i], p) != NULL) found = TRUE;
           if (outProcQ(&external_blocked_list[1][i], p) != NULL) found = TRUE;
@@ -145,53 +437,36 @@ void destroyProcess(pcb_t *p) {
           if (outProcQ(&external_blocked_list[3][i], p) != NULL) found = TRUE;
           if (outProcQ(&terminal_blocked_list[0][i], p) != NULL) found = TRUE;
           if (outProcQ(&terminal_blocked_list[1][i], p) != NULL) found = TRUE;
+          if (outProcQ(&term_readers[i], p) != NULL) found = TRUE;
         }
       } else {
         found = TRUE;
       }
-      // Decrease waiting_count only if the process was blocked for IO or pseudoclock
+      // Decrease waiting_count only if the process was blocked for IO, a terminal line or sleeping
       if (found) waiting_count--;
     }
+    cancelDeviceIO(p);  // Its pending I/O completions go to nobody
+    edfLeave(p);  // Release its EDF utilization, if any
+    dropWaiters(p);  // Give back the inherited priority and detach the waiters
     freePcb(p);  // Free the PCB
     process_count--;  // Decrement the process count
   }
 }
 
 /**
- * @brief Blocks a process in the device list for the specified IO operation.
+ * @brief Blocks a process in the device queue for the specified IO operation.
+ * The device is decoded from the command register address; the command is written
+ * as soon as the requests queued before it on the same device complete.
  * @param arg Pointer to the DOIO structure.
  * @param toBlock The process to block.
+ * @return TRUE if the process is blocked, FALSE if the address is not a command register.
  */
-static void blockForDevice(ssi_do_io_t *arg, pcb_t *toBlock) {
-  // Iterate over terminal devices
-  for (int dev = 0; dev < MAXDEV; dev++) {
-    // Calculate the base address for the device
-    termreg_t *base_address = (termreg_t *)DEV_REG_ADDR(TERMINT, dev);
-    if (arg->commandAddr == (memaddr) & (base_address->recv_command)) {
-      // Insert the process into the respective blocked list for the terminal receive command
-      insertProcQ(&terminal_blocked_list[1][dev], toBlock);
-      waiting_count++;
-      *arg->commandAddr = arg->commandValue;  // Set the command value for the operation
-      return;
-    } else if (arg->commandAddr == (memaddr) & (base_address->transm_command)) {
-      // Insert the process into the respective blocked list for the terminal transmit command
-      insertProcQ(&terminal_blocked_list[0][dev], toBlock);
-      waiting_count++;
-      *arg->commandAddr = arg->commandValue;  // Set the command value for the operation
-      return;
-    }
-  }
-  // Iterate over other devices
-  for (int line = 3; line < 7; line++) {
-    for (int dev = 0; dev < MAXDEV; dev++) {
-      dtpreg_t *base_address = (dtpreg_t *)DEV_REG_ADDR(line, dev);
-      if (arg->commandAddr == (memaddr) & (base_address->command)) {
-        // Insert the process into the respective blocked list for the device
-        insertProcQ(&external_blocked_list[line - 3][dev], toBlock);
-      }
-    }
-  }
+static int blockForDevice(ssi_do_io_t *arg, pcb_t *toBlock) {
+  int index = deviceIndex(arg->commandAddr);
+  if (index == NOPROC) return FALSE;
 
-  waiting_count++;  // Increment waiting count as the process is blocked
-  *arg->commandAddr = arg->commandValue;  // Set the command value for the operation
+  // From now on the process waits for the device, not for the SSI
+  stopWaiting(toBlock);
+  submitIO(index, toBlock, arg->commandAddr, arg->commandValue);
+  return TRUE;
 }
@@ -11,10 +11,20 @@
 #include <umps/arch.h>
 
 void SSIHandler();
+static unsigned int handleRequest(ssi_payload_t *p_payload, pcb_t *sender, int *reply);
+static unsigned int handleBatch(ssi_batch_t *batch, pcb_t *sender, int *reply);
+static int senderGone(pcb_t *sender, int pid);
 static unsigned int createProcess(ssi_create_process_t *arg, pcb_t *sender);
+static void startChild(pcb_t *p, pcb_t *sender);
+static unsigned int registerTemplate(ssi_create_process_t *arg);
+static unsigned int spawnProcesses(ssi_spawn_t *arg, pcb_t *sender);
 void terminateProcess(pcb_t *p);
-void terminateProgeny(pcb_t *p);
+static void terminateTree(pcb_t *p, int preemptible);
+static void killTree(pcb_t *p);
+static pcb_t *newPcb();
+int isDead(pcb_t *p);
+int reapDead();
 void destroyProcess(pcb_t *p);
-static void blockForDevice(ssi_do_io_t *arg, pcb_t *toBlock);
+static int blockForDevice(ssi_do_io_t *arg, pcb_t *toBlock);
 
 #endif
\ No newline at end of file
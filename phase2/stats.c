@@ -0,0 +1,46 @@
+#include "stats.h"
+
+extern latency_stats_t latency_stats;
+
+/**
+ * @brief Clears every latency histogram.
+ */
+void initLatencyStats() {
+  unsigned int *words = (unsigned int *) &latency_stats;
+  for (int i = 0; i < sizeof(latency_stats_t) / WORDLEN; i++) {
+    words[i] = 0;
+  }
+}
+
+/**
+ * @brief Records the time elapsed since a timestamp in a log2 histogram.
+ *
+ * @param hist histogram to update
+ * @param since TOD at which the measured interval started
+ */
+void recordLatency(latency_hist_t *hist, cpu_t since) {
+  cpu_t now;
+  STCK(now);
+  unsigned int elapsed = (unsigned int) (now - since);
+
+  // The bucket is the position of the most significant bit set
+  int bucket = 0;
+  while (elapsed != 0 && bucket < HISTBUCKETS - 1) {
+    elapsed >>= 1;
+    bucket++;
+  }
+  hist->buckets[bucket]++;
+}
+
+/**
+ * @brief Copies a snapshot of the latency histograms.
+ *
+ * @param dest where to copy the histograms
+ */
+void copyLatencyStats(latency_stats_t *dest) {
+  unsigned int *src = (unsigned int *) &latency_stats;
+  unsigned int *dst = (unsigned int *) dest;
+  for (int i = 0; i < sizeof(latency_stats_t) / WORDLEN; i++) {
+    dst[i] = src[i];
+  }
+}
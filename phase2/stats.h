@@ -0,0 +1,16 @@
+/*
+  Nucleus latency statistics
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <umps/libumps.h>
+#include "../headers/const.h"
+#include "../headers/types.h"
+
+void initLatencyStats();
+void recordLatency(latency_hist_t *hist, cpu_t since);
+void copyLatencyStats(latency_stats_t *dest);
+
+#endif
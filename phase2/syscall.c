@@ -3,15 +3,24 @@
 #include "../phase1/headers/pcb.h"
 #include "../phase1/headers/msg.h"
 #include "scheduler.h"
+#include "stats.h"
+#include "device.h"
+#include "disk.h"
+#include "timer.h"
 
 extern pcb_PTR current_process;
-extern struct list_head ready_queue;
-extern struct list_head pseudoclock_blocked_list;
+extern struct list_head wait_table[WAITBUCKETS];
 extern pcb_PTR ssi_pcb;
+extern pcb_PTR ssi_shards[SSISHARDS];
 extern state_t *currentState;
 extern void terminateProcess(pcb_t *proc);
 extern int isInDevicesLists(pcb_t *p);
+extern int isDead(pcb_t *p);
+extern int isInAMPLists(pcb_t *p);
 extern void copyRegisters(state_t *dest, state_t *src);
+extern void saveState(pcb_t *p);
+extern latency_stats_t latency_stats;
+extern cpu_t dispatch_tod;
 
 /**
  * @brief Handles the request for a send or receive system call.
@@ -34,6 +43,46 @@ void syscallHandler() {
                 receiveMessage();
                 LDST(currentState);  // Load the state after receiving the message
                 break;
+            case YIELDTO:
+                yieldTo();
+                LDST(currentState);  // Load the state if the slice was not donated
+                break;
+            case WAITWORD:
+                waitWord();
+                LDST(currentState);  // Load the state if the word had changed
+                break;
+            case WAKEWORD:
+                wakeWord();
+                LDST(currentState);  // Load the state after waking the waiters
+                break;
+            case KDOIO:
+                kernelDoIO();
+                LDST(currentState);  // Load the state if the request was invalid
+                break;
+            case READLINE:
+                readLine();
+                LDST(currentState);  // Load the state after reading the line
+                break;
+            case KDOIOV:
+                kernelDoIOV();
+                LDST(currentState);  // Load the state if the request was invalid
+                break;
+            case DISKIO:
+                diskDoIO();
+                LDST(currentState);  // Load the state if the request was invalid
+                break;
+            case KGETTIME:
+                getTime();
+                LDST(currentState);  // Load the state with the time in v0
+                break;
+            case KGETSUPPORTPTR:
+                getSupportPtr();
+                LDST(currentState);  // Load the state with the support structure in v0
+                break;
+            case KGETPROCESSID:
+                getProcessID();
+                LDST(currentState);  // Load the state with the process ID in v0
+                break;
             default:
                 passUpOrDie(GENERALEXCEPT);  // If unrecognized, handle as a general exception
                 break;  
@@ -51,16 +100,24 @@ void sendMessage() {
     unsigned int payload = currentState->reg_a2;
     int messagePushed = FALSE, found = FALSE;
 
-    // Check if the receiver is in the free PCB list
-    if(isInPCBFree_h(receiver)) {
+    // The SSI instances share one address: the request goes to the instance of the sender,
+    // and every instance answers as the SSI
+    pcb_PTR sender = isSSIShard(current_process) ? ssi_pcb : current_process;
+    if (receiver == ssi_pcb) {
+        receiver = ssiShard(current_process);
+    }
+
+    // Check if the receiver is in the free PCB list, or killed and waiting for the reaper
+    int gone = isInPCBFree_h(receiver) || isDead(receiver);
+    if(gone) {
         found = TRUE;
         currentState->reg_v0 = DEST_NOT_EXIST;  // Receiver does not exist
     }
 
-    // Check if the receiver is currently running or in any waiting list (ready, pseudoclock, or devices)
-    if (!found && (receiver == current_process || isInList(&ready_queue, receiver) || isInList(&pseudoclock_blocked_list, receiver) || isInDevicesLists(receiver))) {
+    // Check if the receiver is currently running or in any waiting list (ready, timer wheel, or devices)
+    if (!found && !isWaitingForMessage(receiver)) {
         found = TRUE;
-        msg_PTR toPush = createMessage(current_process, payload);
+        msg_PTR toPush = createMessage(sender, payload);
         if (toPush != NULL) {
             insertMessage(&receiver->msg_inbox, toPush);  // Add the message to the receiver's inbox
             messagePushed = TRUE;
@@ -69,19 +126,20 @@ void sendMessage() {
 
     // If the receiver was not found in the lists, push the message into their inbox and wake them up
     if(!found) {
-        msg_PTR toPush = createMessage(current_process, payload);
+        msg_PTR toPush = createMessage(sender, payload);
         if (toPush != NULL) {
             insertMessage(&receiver->msg_inbox, toPush);  // Add the message to the receiver's inbox
             messagePushed = TRUE;
-            insertProcQ(&ready_queue, receiver);  // Wake up the receiver by adding them to the ready queue
+            stopWaiting(receiver);  // The holder no longer inherits the receiver's priority
+            readyProcess(receiver);  // Wake up the receiver by adding them to the ready queue
         }
     }
 
     // If the message was successfully pushed, set reg_v0 to OK
     if(messagePushed) {
         currentState->reg_v0 = OK;
-    } else if(!isInPCBFree_h(receiver)) {
-        // Otherwise, set reg_v0 to MSGNOGOOD if the receiver was not in the free PCB list
+    } else if(!gone) {
+        // Otherwise, set reg_v0 to MSGNOGOOD if the receiver still exists
         currentState->reg_v0 = MSGNOGOOD;
     }
 
@@ -89,6 +147,40 @@ void sendMessage() {
     currentState->pc_epc += WORDLEN;
 }
 
+/**
+ * @brief Finds the SSI instance serving a process.
+ *
+ * @param p pointer to the requesting process
+ * @return The instance its requests (and the completions of its DOIOs) go to
+ */
+pcb_PTR ssiShard(pcb_PTR p) {
+    return ssi_shards[p->p_pid % SSISHARDS];
+}
+
+/**
+ * @brief Checks if a process is an SSI instance.
+ *
+ * @param p pointer to the process to check
+ * @return 1 if it is one of the SSI instances, 0 otherwise
+ */
+int isSSIShard(pcb_PTR p) {
+    for (int i = 0; i < SSISHARDS; i++) {
+        if (ssi_shards[i] == p) return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Checks if a process is blocked in RECEIVEMESSAGE.
+ * A live process that is not running, ready or waiting on anything else can only be waiting for a message.
+ *
+ * @param p pointer to the process to check, not free
+ * @return 1 if a new message must wake it up, 0 otherwise
+ */
+int isWaitingForMessage(pcb_PTR p) {
+    return !(p == current_process || isReady(p) || isSleeping(p) || isInDevicesLists(p) || isInAMPLists(p) || p->p_waitWord != NULL);
+}
+
 /**
  * @brief Extracts a message from the inbox or waits for a message if the inbox is empty.
  * This function handles the case where the process waits for a message if no message is available.
@@ -103,8 +195,14 @@ void receiveMessage() {
 
     // If no message is found, block the process
     if(messageExtracted == NULL) {
-        copyRegisters(&current_process->p_s, currentState);  // Save the current state
-        current_process->p_time += (TIMESLICE - getTIMER());  // Adjust time
+        saveState(current_process);  // Save the current state
+        chargeTime(current_process);  // Consume the EDF budget or the group share
+        // Lend the priority to the process it is waiting on
+        if (sender == ssi_pcb) {
+            waitOn(current_process, ssiShard(current_process));
+        } else if (sender != ANYMESSAGE && sender != current_process && !isInPCBFree_h(sender)) {
+            waitOn(current_process, sender);
+        }
         current_process = NULL;
         schedule();  // Call the scheduler to handle context switch
     } 
@@ -118,11 +216,140 @@ void receiveMessage() {
         // Store the sender's address in reg_v0
         currentState->reg_v0 = (memaddr) messageExtracted->m_sender;
 
+        // A server taking a new request works on behalf of its sender from now on
+        if (current_process->p_server && sender == ANYMESSAGE) {
+            billTo(current_process, messageExtracted->m_sender);
+        }
+
+        // Account the time the message spent in the inbox
+        recordLatency(&latency_stats.msg_queueing, messageExtracted->m_sendTOD);
+
         freeMsg(messageExtracted);  // Free the message after processing
         currentState->pc_epc += WORDLEN;  // Increment PC to avoid infinite loops
     }
 }
 
+/**
+ * @brief Donates the rest of the time slice to a ready process.
+ * The target leaves its ready queue and runs immediately, while the caller goes back
+ * to the tail of its own ready queue. The target is charged for the time it runs,
+ * as if it had been dispatched by the scheduler.
+ */
+void yieldTo() {
+    pcb_PTR target = (pcb_PTR)currentState->reg_a1;
+
+    // Increment PC to avoid infinite loops
+    currentState->pc_epc += WORDLEN;
+
+    if (isInPCBFree_h(target)) {
+        currentState->reg_v0 = DEST_NOT_EXIST;  // Target does not exist
+        return;
+    }
+
+    // Only a process waiting in a ready queue of this processor can take the slice
+    if (target == current_process || !canDonate(target)) {
+        currentState->reg_v0 = MSGNOGOOD;
+        return;
+    }
+
+    currentState->reg_v0 = OK;
+    unsigned int ticksLeft = getTIMER();
+
+    // Save the donor and put it back in its ready queue
+    saveState(current_process);
+    chargeTime(current_process);
+    readyProcess(current_process);
+
+    donateSlice(target, ticksLeft);
+}
+
+/**
+ * @brief Blocks the caller in the wait table, if a word still holds the expected value.
+ * The check and the block are atomic, since the nucleus runs with interrupts disabled.
+ * If a3 is the process owning the word (e.g. the holder of a lock), it inherits
+ * the priority of the caller until the caller is woken up.
+ */
+void waitWord() {
+    memaddr *word = (memaddr *)currentState->reg_a1;
+    unsigned int expected = currentState->reg_a2;
+    pcb_PTR owner = (pcb_PTR)currentState->reg_a3;
+
+    // Increment PC to avoid infinite loops
+    currentState->pc_epc += WORDLEN;
+
+    // The word changed in the meantime: let the caller check it again
+    if (*word != expected) {
+        currentState->reg_v0 = MSGNOGOOD;
+        return;
+    }
+    currentState->reg_v0 = OK;
+
+    saveState(current_process);  // Save the current state
+    chargeTime(current_process);  // Consume the EDF budget or the group share
+    current_process->p_waitWord = word;
+    insertProcQ(&wait_table[waitBucket(word)], current_process);
+    if (owner != NULL && owner != current_process && !isInPCBFree_h(owner)) {
+        waitOn(current_process, owner);
+    }
+    current_process = NULL;
+    schedule();
+}
+
+/**
+ * @brief Wakes up to a2 processes blocked on a word, in FIFO order, and returns how many were woken.
+ * The processes left blocked on the word now inherit into the first one woken,
+ * since that is the one about to own the word.
+ */
+void wakeWord() {
+    memaddr *word = (memaddr *)currentState->reg_a1;
+    int count = currentState->reg_a2;
+    struct list_head *bucket = &wait_table[waitBucket(word)];
+    pcb_PTR first = NULL;
+    int woken = 0;
+
+    struct list_head *pos = bucket->next;
+    while (pos != bucket) {
+        pcb_PTR p = container_of(pos, pcb_t, p_list);
+        pos = pos->next;
+        if (p->p_waitWord != word) continue;
+
+        if (woken < count) {
+            list_del(&p->p_list);
+            p->p_waitWord = NULL;
+            stopWaiting(p);
+            readyProcess(p);
+            if (first == NULL) first = p;
+            woken++;
+        } else if (first != NULL && p->p_waitingOn == current_process) {
+            waitOn(p, first);
+        }
+    }
+
+    currentState->reg_v0 = woken;
+    currentState->pc_epc += WORDLEN;
+}
+
+/**
+ * @brief Computes the wait table bucket of a word.
+ * @param word The address of the word.
+ * @return The index of the bucket.
+ */
+int waitBucket(memaddr *word) {
+    return (((memaddr) word) >> 2) % WAITBUCKETS;
+}
+
+/**
+ * @brief Removes a process from the wait table.
+ * @param p The process to remove.
+ * @return TRUE if the process was blocked with WAITWORD, FALSE otherwise.
+ */
+int outWaitTable(pcb_t *p) {
+    if (p->p_waitWord == NULL) return FALSE;
+    outProcQ(&wait_table[waitBucket(p->p_waitWord)], p);
+    p->p_waitWord = NULL;
+    return TRUE;
+}
+
 /**
  * @brief Handles the exception by either passing it up or terminating the process.
  * @param indexValue Determines whether it's a PGFAULTEXCEPT or GENERALEXCEPT.
@@ -132,21 +359,61 @@ void passUpOrDie(int indexValue) {
     if(current_process->p_supportStruct != NULL) {
         copyRegisters(&current_process->p_supportStruct->sup_exceptState[indexValue], currentState);
 
-        unsigned int stackPtr, status, progCounter;
-        stackPtr = current_process->p_supportStruct->sup_exceptContext[indexValue].stackPtr;
-        status = current_process->p_supportStruct->sup_exceptContext[indexValue].status;
-        progCounter = current_process->p_supportStruct->sup_exceptContext[indexValue].pc;
+        // Enter the handler with the support structure as its argument (a0), so it needs no SSI request
+        context_t *context = &current_process->p_supportStruct->sup_exceptContext[indexValue];
+        currentState->reg_sp = context->stackPtr;
+        currentState->status = context->status;
+        currentState->pc_epc = context->pc;
+        currentState->reg_t9 = context->pc;
+        currentState->reg_a0 = (memaddr) current_process->p_supportStruct;
 
-        LDCXT(stackPtr, status, progCounter);  // Load the context for exception handling
+        LDST(currentState);  // Load the context for exception handling
     }
     // Or terminate the process if no support structure exists
     else {
+        // If its tree is already being terminated the process is parked, that termination frees it
         terminateProcess(current_process);  // Terminate the process
         current_process = NULL;
         schedule();  // Call the scheduler for a new process
     }
 }
 
+/**
+ * @brief Returns in v0 the processor time of the caller, the current time slice included.
+ * Same as the GETTIME service of the SSI, without the message round trip.
+ */
+void getTime() {
+    cpu_t now;
+    STCK(now);
+    // The PLT may have been loaded with less than TIMESLICE: measure from the dispatch
+    currentState->reg_v0 = current_process->p_time + (now - dispatch_tod);
+    currentState->pc_epc += WORDLEN;  // Increment PC to avoid infinite loops
+}
+
+/**
+ * @brief Returns in v0 the support structure of the caller.
+ * Same as the GETSUPPORTPTR service of the SSI, without the message round trip.
+ */
+void getSupportPtr() {
+    currentState->reg_v0 = (memaddr) current_process->p_supportStruct;
+    currentState->pc_epc += WORDLEN;  // Increment PC to avoid infinite loops
+}
+
+/**
+ * @brief Returns in v0 the process ID of the caller if a1 is 0, of its parent otherwise (0 if it has none).
+ * Same as the GETPROCESSID service of the SSI, without the message round trip.
+ */
+void getProcessID() {
+    if (currentState->reg_a1 == 0) {
+        currentState->reg_v0 = current_process->p_pid;
+    } else if (current_process->p_parent == NULL) {
+        currentState->reg_v0 = 0;
+    } else {
+        currentState->reg_v0 = current_process->p_parent->p_pid;
+    }
+    currentState->pc_epc += WORDLEN;  // Increment PC to avoid infinite loops
+}
+
 /**
  * @brief Allocates a new message.
  * @param sender The sender of the message.
@@ -158,6 +425,7 @@ msg_PTR createMessage(pcb_PTR sender, unsigned int payload) {
     if (newMsg != NULL) {
         newMsg->m_sender = sender;  // Set the sender of the message
         newMsg->m_payload = payload;  // Set the payload of the message
+        STCK(newMsg->m_sendTOD);  // Timestamp the send
     }
     return newMsg;
 }
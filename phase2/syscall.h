@@ -12,7 +12,18 @@
 void syscallHandler();
 void sendMessage();
 void receiveMessage();
+void yieldTo();
+void waitWord();
+void wakeWord();
+int waitBucket(memaddr *word);
+int outWaitTable(pcb_t *p);
 void passUpOrDie(int);
+void getTime();
+void getSupportPtr();
+void getProcessID();
 msg_PTR createMessage(pcb_PTR sender, unsigned int payload);
+int isWaitingForMessage(pcb_PTR p);
+pcb_PTR ssiShard(pcb_PTR p);
+int isSSIShard(pcb_PTR p);
 
 #endif
\ No newline at end of file
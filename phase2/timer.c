@@ -0,0 +1,256 @@
+#include "timer.h"
+
+#include "../phase1/headers/pcb.h"
+#include "scheduler.h"
+
+extern int waiting_count;
+extern struct list_head timer_wheel[WHEELLEVELS][WHEELSLOTS];
+extern int wheel_count[WHEELLEVELS];
+extern unsigned int wheel_now;
+extern unsigned int wheel_tod;
+
+/**
+ * @brief Empties the timer wheel and synchronizes it with the TOD.
+ */
+void initTimerWheel() {
+  for (int level = 0; level < WHEELLEVELS; level++) {
+    for (int slot = 0; slot < WHEELSLOTS; slot++) {
+      mkEmptyProcQ(&timer_wheel[level][slot]);
+    }
+    wheel_count[level] = 0;
+  }
+  wheel_now = 0;
+  wheel_tod = *((unsigned int *)TODLOADDR);
+}
+
+/**
+ * @brief Measures the time elapsed since the start of the current wheel tick.
+ * The difference of the raw TOD values stays right when the TOD wraps around,
+ * the wheel never lags behind by anywhere near that much.
+ *
+ * @return Microseconds elapsed since the start of tick wheel_now
+ */
+static unsigned int elapsedInTick() {
+  return (*((unsigned int *)TODLOADDR) - wheel_tod) / (*((unsigned int *)TIMESCALEADDR));
+}
+
+/**
+ * @brief Reads the TOD in wheel ticks.
+ *
+ * @return The number of WHEELTICK periods elapsed since boot
+ */
+unsigned int currentTick() {
+  return wheel_now + elapsedInTick() / WHEELTICK;
+}
+
+/**
+ * @brief Inserts a sleeping process in the wheel, at the level covering the distance to its wake-up tick.
+ * Level 0 has one slot per tick, every further level slots WHEELSLOTS times wider.
+ * A process too far in the future waits in the last slot of the last level and is moved again from there.
+ *
+ * @param p pointer to the process, with p_wakeTick after wheel_now
+ */
+static void wheelInsert(pcb_t *p) {
+  unsigned int delta = p->p_wakeTick - wheel_now;
+  unsigned int tick = p->p_wakeTick;
+  int level = 0;
+
+  while (level < WHEELLEVELS - 1 && delta >= (1U << (WHEELBITS * (level + 1)))) {
+    level++;
+  }
+  if (delta >= (1U << (WHEELBITS * WHEELLEVELS))) {
+    tick = wheel_now + (1U << (WHEELBITS * WHEELLEVELS)) - 1;
+  }
+
+  p->p_wheelLevel = level;
+  wheel_count[level]++;
+  insertProcQ(&timer_wheel[level][(tick >> (WHEELBITS * level)) & (WHEELSLOTS - 1)], p);
+}
+
+/**
+ * @brief Moves the processes of a slot one level down (or to their final slot).
+ *
+ * @param level level of the slot
+ * @param slot index of the slot
+ */
+static void cascade(int level, unsigned int slot) {
+  struct list_head *head = &timer_wheel[level][slot];
+  while (!emptyProcQ(head)) {
+    pcb_PTR p = removeProcQ(head);
+    wheel_count[level]--;
+    wheelInsert(p);
+  }
+}
+
+/**
+ * @brief Advances the wheel by one tick: redistributes the slots of the upper levels
+ *        starting at this tick, then wakes up every process of the current slot.
+ */
+static void wheelTick() {
+  wheel_now++;
+  for (int level = WHEELLEVELS - 1; level > 0; level--) {
+    if ((wheel_now & ((1U << (WHEELBITS * level)) - 1)) == 0) {
+      cascade(level, (wheel_now >> (WHEELBITS * level)) & (WHEELSLOTS - 1));
+    }
+  }
+
+  struct list_head *head = &timer_wheel[0][wheel_now & (WHEELSLOTS - 1)];
+  while (!emptyProcQ(head)) {
+    pcb_PTR p = removeProcQ(head);
+    wheel_count[0]--;
+    p->p_wheelLevel = NOPROC;
+    waiting_count--;
+    readyProcess(p);
+  }
+}
+
+/**
+ * @brief Brings the wheel up to the current tick, waking up the expired processes.
+ * Runs of empty levels are skipped up to the next slot boundary, so the work done
+ * is proportional to the expired processes and slots, not to the elapsed ticks.
+ *
+ * @param nowTick current tick
+ */
+void advanceWheel(unsigned int nowTick) {
+  if ((int) (nowTick - wheel_now) <= 0) return;
+
+  // The start of the current tick moves forward with it
+  wheel_tod += (nowTick - wheel_now) * WHEELTICK * (*((unsigned int *)TIMESCALEADDR));
+
+  while ((int) (nowTick - wheel_now) > 0) {
+    // Lowest level with sleeping processes
+    int level = 0;
+    while (level < WHEELLEVELS && wheel_count[level] == 0) {
+      level++;
+    }
+    if (level == WHEELLEVELS) {
+      wheel_now = nowTick;
+      return;
+    }
+
+    // Level 0 expires at every tick, the upper levels only cascade at their slot boundaries
+    unsigned int next = wheel_now + 1;
+    if (level > 0) {
+      next = (wheel_now | ((1U << (WHEELBITS * level)) - 1)) + 1;
+    }
+    if ((int) (next - nowTick) > 0) {
+      wheel_now = nowTick;
+      return;
+    }
+
+    wheel_now = next - 1;
+    wheelTick();
+  }
+}
+
+/**
+ * @brief Finds the next tick at which the wheel has work to do:
+ *        an expiry at level 0, a cascade at the upper levels.
+ *
+ * @param tick pointer where the tick is stored
+ * @return TRUE if some process is sleeping, FALSE otherwise
+ */
+static int nextWheelEvent(unsigned int *tick) {
+  int found = FALSE;
+  for (int level = 0; level < WHEELLEVELS; level++) {
+    if (wheel_count[level] == 0) continue;
+
+    // The first non-empty slot after the current one, at this level
+    unsigned int base = wheel_now >> (WHEELBITS * level);
+    for (unsigned int i = 1; i <= WHEELSLOTS; i++) {
+      if (!emptyProcQ(&timer_wheel[level][(base + i) & (WHEELSLOTS - 1)])) {
+        unsigned int event = (base + i) << (WHEELBITS * level);
+        if (!found || (int) (event - *tick) < 0) *tick = event;
+        found = TRUE;
+        break;
+      }
+    }
+  }
+  return found;
+}
+
+/**
+ * @brief Loads the interval timer with the time left to the next wheel event.
+ * With no sleeping process the interval timer ticks every pseudo-second, to no effect.
+ */
+void programIntervalTimer() {
+  unsigned int tick;
+  if (!nextWheelEvent(&tick)) {
+    LDIT(PSECOND);
+    return;
+  }
+
+  // Relative to now: the wheel ticks count from boot, the TOD may have wrapped around
+  int wait = (int) ((tick - wheel_now) * WHEELTICK) - (int) elapsedInTick();
+  LDIT(wait > 0 ? wait : 1);
+}
+
+/**
+ * @brief Blocks a process until a given tick.
+ * The process must be blocked already (e.g. waiting for the SSI reply): if the tick
+ * has already passed it is left as it is.
+ *
+ * @param p pointer to the process
+ * @param wakeTick tick at which the process is woken up
+ */
+void sleepUntil(pcb_t *p, unsigned int wakeTick) {
+  advanceWheel(currentTick());
+  if ((int) (wakeTick - wheel_now) <= 0) return;
+
+  stopWaiting(p);  // The process waits for the timer, not for the SSI
+  p->p_wakeTick = wakeTick;
+  wheelInsert(p);
+  waiting_count++;
+  programIntervalTimer();
+}
+
+/**
+ * @brief Blocks a process for at least the given time.
+ *
+ * @param p pointer to the process
+ * @param micros time to sleep, in microseconds
+ */
+void sleepFor(pcb_t *p, unsigned int micros) {
+  sleepUntil(p, wheel_now + (elapsedInTick() + micros + WHEELTICK - 1) / WHEELTICK);
+}
+
+/**
+ * @brief Blocks a process until the next pseudo-clock tick (a multiple of PSECOND).
+ *
+ * @param p pointer to the process
+ */
+void sleepClockTick(pcb_t *p) {
+  sleepUntil(p, ((currentTick() / (PSECOND / WHEELTICK)) + 1) * (PSECOND / WHEELTICK));
+}
+
+/**
+ * @brief Checks if a process is sleeping in the timer wheel.
+ *
+ * @param p pointer to the process
+ * @return TRUE if it is sleeping, FALSE otherwise
+ */
+int isSleeping(pcb_t *p) {
+  return p->p_wheelLevel != NOPROC;
+}
+
+/**
+ * @brief Removes a process from the timer wheel.
+ *
+ * @param p pointer to the process
+ * @return TRUE if it was sleeping, FALSE otherwise
+ */
+int cancelSleep(pcb_t *p) {
+  if (!isSleeping(p)) return FALSE;
+  list_del(&p->p_list);
+  wheel_count[p->p_wheelLevel]--;
+  p->p_wheelLevel = NOPROC;
+  return TRUE;
+}
+
+/**
+ * @brief Handles the interval timer interrupt: wakes up the expired processes and reloads the timer.
+ */
+void timerInterruptHandler() {
+  advanceWheel(currentTick());
+  programIntervalTimer();
+}
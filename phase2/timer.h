@@ -0,0 +1,23 @@
+/*
+  Nucleus timer wheel
+*/
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <umps/libumps.h>
+#include "../headers/const.h"
+#include "../headers/types.h"
+
+void initTimerWheel();
+unsigned int currentTick();
+void sleepUntil(pcb_t *p, unsigned int wakeTick);
+void sleepFor(pcb_t *p, unsigned int micros);
+void sleepClockTick(pcb_t *p);
+int isSleeping(pcb_t *p);
+int cancelSleep(pcb_t *p);
+void timerInterruptHandler();
+void advanceWheel(unsigned int nowTick);
+void programIntervalTimer();
+
+#endif
@@ -3,8 +3,10 @@
 extern pcb_PTR current_process;
 extern pcb_PTR ssi_pcb;
 extern void SSTInitialize();
-extern void supportExceptionHandler();
-extern void pager();
+extern void supportExceptionHandler(support_t *supPtr);
+extern void pager(support_t *support_PTR);
+extern int zeroFreeFrames();
+extern int registerIdleTask(idle_task_t task);
 
 /**
  * Test function for phase 3
@@ -14,18 +16,18 @@ extern void pager();
 void test() {
   test_pcb = current_process;
   RAMTOP(addr);
-  // Move beyond the SSI and test processes
-  addr -= (3 * PAGESIZE);
+  // Move beyond the SSI instances and the test process
+  addr -= ((SSISHARDS + 1) * PAGESIZE);
 
   // Initialize swap pool
   initSwapPool();
 
+  // Zero-fill the free frames of the swap pool while the CPU is idle
+  registerIdleTask(zeroFreeFrames);
+
   // Initialize U-proc
   initUproc();
 
-  // Initialize mutex for swap processes
-  initSwapMutex();
-
   // Initialize the SST (System Support Tables)
   initSST();
 
@@ -36,7 +38,7 @@ void test() {
 
   // Terminate the test process
   ssi_payload_t termPayload = {
-    .service_code = TERMPROCESS,
+    .service_code = KILLPROCESS,
     .arg = NULL,
   };
   SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &termPayload, 0);
@@ -50,13 +52,15 @@ void test() {
  * Initializes the state for each U-proc (user process)
  */
 static void initUproc() {
-  for (int asid = 1; asid <= 8; asid++) {
-    uprocStates[asid - 1].pc_epc = (memaddr) UPROCSTARTADDR;
-    uprocStates[asid - 1].reg_t9 = (memaddr) UPROCSTARTADDR;
-    uprocStates[asid - 1].reg_sp = (memaddr) USERSTACKTOP;
-    uprocStates[asid - 1].status = ALLOFF | USERPON | IEPON | IMON | TEBITON;
-    uprocStates[asid - 1].entry_hi = asid << ASIDSHIFT;
+  // The U-procs only differ in their ASID and support structure: each SST spawns its own from a template
+  uprocState.pc_epc = (memaddr) UPROCSTARTADDR;
+  uprocState.reg_t9 = (memaddr) UPROCSTARTADDR;
+  uprocState.reg_sp = (memaddr) USERSTACKTOP;
+  uprocState.status = ALLOFF | USERPON | IEPON | IMON | TEBITON;
+  uprocState.entry_hi = 0;
+  uproc_template = registerTemplate(&uprocState);
 
+  for (int asid = 1; asid <= 8; asid++) {
     // Initialize support structures
     supports[asid - 1].sup_asid = asid;
     supports[asid - 1].sup_exceptContext[PGFAULTEXCEPT].stackPtr = (memaddr) addr;
@@ -79,9 +83,11 @@ static void initUproc() {
  * Initializes the swap pool by setting all entries to NOPROC and -1 (no assigned page)
  */
 static void initSwapPool() {
+  swap_lock = 0;
   for (int i = 0; i < POOLSIZE; i++) {
     swap_pool[i].swpo_asid = NOPROC;
     swap_pool[i].swpo_page = -1;
+    swap_pool[i].swpo_zeroed = FALSE;
   }
 }
 
@@ -89,28 +95,56 @@ static void initSwapPool() {
  * Initializes and creates SST (System Support Tables) processes
  */
 static void initSST() {
+  ssi_spawn_override_t overrides[UPROCMAX];
+
+  // Every SST runs the same code, only the stack, the ASID and the support structure change
+  sstState.pc_epc = (memaddr) SSTInitialize;
+  sstState.reg_t9 = (memaddr) SSTInitialize;
+  sstState.status = ALLOFF | IEPON | IMON | TEBITON;
+  sstState.entry_hi = 0;
+  int sstTemplate = registerTemplate(&sstState);
+
   for (int asid = 1; asid <= 8; asid++) {
-    // Initialize the state for each SST
-    sstStates[asid - 1].reg_sp = (memaddr) addr;
-    sstStates[asid - 1].pc_epc = (memaddr) SSTInitialize;
-    sstStates[asid - 1].reg_t9 = (memaddr) SSTInitialize;
-    sstStates[asid - 1].status = ALLOFF | IEPON | IMON | TEBITON;
-    sstStates[asid - 1].entry_hi = asid << ASIDSHIFT;
-
-    // Create the process by sending a request to the SSI
-    ssi_create_process_t create = {
-      .state = &sstStates[asid - 1],
-      .support = &supports[asid - 1],
-    };
-    ssi_payload_t createPayload = {
-      .service_code = CREATEPROCESS,
-      .arg = &create,
-    };
-    SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &createPayload, 0);
-    SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &sstArray[asid - 1], 0);
-    
+    overrides[asid - 1].sp = (memaddr) addr;
+    overrides[asid - 1].asid = asid;
+    overrides[asid - 1].support = &supports[asid - 1];
     addr -= PAGESIZE;
   }
+
+  // Create all the SSTs with a single request to the SSI
+  ssi_spawn_t spawn = {
+    .id = sstTemplate,
+    .count = UPROCMAX,
+    .overrides = overrides,
+    .spawned = sstArray,
+  };
+  ssi_payload_t spawnPayload = {
+    .service_code = SPAWN,
+    .arg = &spawn,
+  };
+  SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &spawnPayload, 0);
+  SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, 0, 0);
+}
+
+/**
+ * Registers a state, with no support structure, as a spawn template
+ *
+ * @param state the state shared by the processes spawned from the template
+ * @return the identifier of the template
+ */
+static int registerTemplate(state_t *state) {
+  int id;
+  ssi_create_process_t template = {
+    .state = state,
+    .support = NULL,
+  };
+  ssi_payload_t payload = {
+    .service_code = REGTEMPLATE,
+    .arg = &template,
+  };
+  SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &payload, 0);
+  SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &id, 0);
+  return id;
 }
 
 /**
@@ -124,42 +158,3 @@ static void initPageTableEntry(unsigned int asid, pteEntry_t *entry, int idx){
     entry->pte_entryHI = 0xBFFFF000 + (asid << ASIDSHIFT); 
   entry->pte_entryLO = DIRTYON;
 }
-
-/**
- * Initializes the swap mutex process that handles mutual exclusion
- */
-static void initSwapMutex() {
-  swapMutexState.reg_sp = (memaddr) addr;
-  swapMutexState.pc_epc = swapMutexState.reg_t9 = (memaddr) swapMutex;
-  swapMutexState.status = ALLOFF | IEPON | IMON | TEBITON;
-
-  addr -= PAGESIZE;
-
-  // Create the mutex process by sending a request to the SSI
-  ssi_create_process_t create = {
-      .state = &swapMutexState,
-      .support = NULL,
-  };
-  ssi_payload_t createPayload = {
-      .service_code = CREATEPROCESS,
-      .arg = &create,
-  };
-  SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &createPayload, 0);
-  SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &swapMutexProcess, 0);
-  
-}
-
-/**
- * Handles the mutual exclusion for swap processes
- * The swapMutex function ensures that only one process can hold the swap mutex at a time.
- */
-void swapMutex() {
-  while(TRUE) {
-    unsigned int sender = SYSCALL(RECEIVEMESSAGE, ANYMESSAGE, 0, 0);
-    mutexHolderProcess = (pcb_t *)sender;
-    SYSCALL(SENDMESSAGE, (unsigned int)sender, 0, 0);
-    // The process holding the mutex must release it
-    SYSCALL(RECEIVEMESSAGE, sender, 0, 0);
-    mutexHolderProcess = NULL;
-  }
-}
@@ -9,21 +9,18 @@
 #include "../headers/const.h"
 #include "../headers/types.h"
 
-// processo che possiede attualmente la mutex
-pcb_PTR mutexHolderProcess;
-// processo mutex
-pcb_PTR swapMutexProcess;
-// state del processo mutex
-state_t swapMutexState; 
+// lock della swap pool: processo che lo possiede, con il bit SWAPLOCKWAITERS se ci sono processi in attesa
+unsigned int swap_lock;
 
 // processo di test
 pcb_PTR test_pcb;
 // indirizzo di memoria corrente
 memaddr addr;
-// state degli U-proc
-state_t uprocStates[UPROCMAX];
-// state degli SST
-state_t sstStates[UPROCMAX];
+// state comune degli U-proc e template registrato con REGTEMPLATE
+state_t uprocState;
+int uproc_template;
+// state comune degli SST
+state_t sstState;
 // strutture di supporto condivise
 support_t supports[UPROCMAX];
 // array dei processi SST
@@ -34,9 +31,8 @@ swpo_t swap_pool[POOLSIZE];
 void test();
 static void initUproc();
 static void initSST();
+static int registerTemplate(state_t *state);
 static void initSwapPool();
-static void initSwapMutex();
-void swapMutex();
 static void initPageTableEntry(unsigned int asid, pteEntry_t *entry, int idx);
 
 #endif
\ No newline at end of file
@@ -2,7 +2,7 @@
 
 extern pcb_PTR test_pcb;
 extern pcb_PTR ssi_pcb;
-extern state_t uprocStates[UPROCMAX];
+extern int uproc_template;
 extern swpo_t swap_pool[POOLSIZE];
 
 /**
@@ -11,27 +11,36 @@ extern swpo_t swap_pool[POOLSIZE];
  * @param s pointer to the state of the U-proc to be created
  */
 void SSTInitialize() {
-  // Request the support structure from the SSI
-  support_t *sup;
-  ssi_payload_t payload_sup = {
-    .service_code = GETSUPPORTPTR,
-    .arg = NULL,
-  };
-  SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &payload_sup, 0);
-  SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &sup, 0);
+  // Read the support structure, the nucleus answers without the SSI
+  support_t *sup = (support_t *) SYSCALL(KGETSUPPORTPTR, 0, 0, 0);
 
-  // Create the child U-proc by sending a request to SSI
+  // Spawn the child U-proc from the template, with its own ASID and support structure
   pcb_PTR p;
-  ssi_create_process_t createProcess = {
-    .state = &uprocStates[sup->sup_asid - 1],
+  ssi_spawn_override_t override = {
+    .sp = 0,
+    .asid = sup->sup_asid,
     .support = sup,
   };
+  ssi_spawn_t spawn = {
+    .id = uproc_template,
+    .count = 1,
+    .overrides = &override,
+    .spawned = &p,
+  };
   ssi_payload_t payload = {
-    .service_code = CREATEPROCESS,
-    .arg = &createProcess,
+    .service_code = SPAWN,
+    .arg = &spawn,
   };
   SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &payload, 0);
-  SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &p, 0);
+  SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, 0, 0);
+
+  // Bill the time spent serving the U-proc to the U-proc itself
+  ssi_payload_t payload_server = {
+    .service_code = REGSERVER,
+    .arg = NULL,
+  };
+  SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &payload_server, 0);
+  SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, 0, 0);
 
   // Invoke the SST handler
   SSTHandler(sup->sup_asid);
@@ -68,6 +77,10 @@ void SSTHandler(int asid) {
         // Write a string to the terminal
         writeTerminal(asid, (sst_print_PTR) p_payload->arg);
         break;
+      case READTERMINAL:
+        // Read a line from the terminal
+        response = readTerminal(asid, (sst_print_PTR) p_payload->arg);
+        break;
       default:
         // Error: Unknown service code
         break;
@@ -92,15 +105,41 @@ void terminate(int asid) {
   // Notify the test process about the termination
   SYSCALL(SENDMESSAGE, (unsigned int) test_pcb, 0, 0);
   
-  // Send a termination request to the SSI
+  // Send a kill request to the SSI
   ssi_payload_t termPayload = {
-    .service_code = TERMPROCESS,
+    .service_code = KILLPROCESS,
     .arg = NULL,
   };
   SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &termPayload, 0);
   SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, 0, 0);
 }
 
+/**
+ * Writes a string of characters to a device, VECIOSIZE characters per request
+ * 
+ * @param command the command register of the device
+ * @param s the string to write
+ * @param success the status of a character written successfully
+ */
+static void writeDevice(memaddr *command, char *s, unsigned int success) {
+  while (*s != EOS) {
+    // The nucleus copies from the SST stack, which needs no TLB entry
+    char chunk[VECIOSIZE];
+    int length = 0;
+    while (*s != EOS && length < VECIOSIZE) {
+      chunk[length++] = *s++;
+    }
+
+    // The nucleus writes the whole chunk and wakes the SST once
+    unsigned int result = SYSCALL(KDOIOV, (unsigned int) command, (unsigned int) chunk, length);
+
+    // Verify if the operation was successful
+    if (VECIOCOUNT(result) != length || VECIOSTATUS(result) != success) {
+      PANIC();
+    }
+  }
+}
+
 /**
  * Writes a string of characters to a printer
  * 
@@ -110,38 +149,8 @@ void terminate(int asid) {
 void writePrinter(int asid, sst_print_PTR arg) {
   // Get the register for the printer to use
   dtpreg_t *base = (dtpreg_t *)DEV_REG_ADDR(PRNTINT, asid - 1);
-  
-  // Variable for operation status
-  unsigned int status;
-  
-  // Get the string to print
-  char *s = arg->string;
 
-  // Send a message for each character in the string
-  while (*s != EOS) {
-    // Place the character into data0 register
-    base->data0 = (unsigned int) *s;
-    
-    // Send a DOIO request to the SSI
-    ssi_do_io_t doIO = {
-      .commandAddr = &base->command,
-      .commandValue = PRINTCHR,
-    };
-    ssi_payload_t ioPayload = {
-      .service_code = DOIO,
-      .arg = &doIO,
-    };
-
-    SYSCALL(SENDMESSAGE, (unsigned int)ssi_pcb, (unsigned int) &ioPayload, 0);
-    SYSCALL(RECEIVEMESSAGE, (unsigned int)ssi_pcb, (unsigned int) &status, 0);
-
-    // Verify if the operation was successful
-    if (status != READY) {
-      PANIC();
-    }
-
-    s++;
-  }
+  writeDevice(&base->command, arg->string, READY);
 }
 
 /**
@@ -153,32 +162,28 @@ void writePrinter(int asid, sst_print_PTR arg) {
 void writeTerminal(int asid, sst_print_PTR arg) {
   // Get the register for the terminal to use
   termreg_t *base = (termreg_t *)DEV_REG_ADDR(TERMINT, asid - 1);
-  
-  // Variable for operation status
-  unsigned int status;
-  
-  // Get the string to print
-  char *s = arg->string;
 
-  // Send a message for each character in the string
-  while (*s != EOS) {
-    // Send a DOIO request to the SSI
-    ssi_do_io_t doIO = {
-      .commandAddr = &base->transm_command,
-      .commandValue = PRINTCHR | (((unsigned int) *s) << 8),
-    };
-    ssi_payload_t ioPayload = {
-      .service_code = DOIO,
-      .arg = &doIO,
-    };
-    SYSCALL(SENDMESSAGE, (unsigned int)ssi_pcb, (unsigned int) &ioPayload, 0);
-    SYSCALL(RECEIVEMESSAGE, (unsigned int)ssi_pcb, (unsigned int) &status, 0);
+  writeDevice(&base->transm_command, arg->string, OKCHARTRANS);
+}
 
-    // Verify if the operation was successful
-    if ((status & TERMSTATMASK) != RECVD) {
-      PANIC();
-    }
+/**
+ * Reads a line from a terminal
+ * The line is taken from the receive buffer of the nucleus, which the SST waits on
+ * only once per line, then copied to the U-proc.
+ * 
+ * @param asid the ASID of the process requesting the read
+ * @param arg payload containing the buffer to fill and its length
+ * @return the number of characters read (newline included), or a negative value on error
+ */
+int readTerminal(int asid, sst_print_PTR arg) {
+  // The nucleus copies into the SST stack, which needs no TLB entry
+  char line[TERMRINGSIZE];
+  int max = arg->length < TERMRINGSIZE ? arg->length : TERMRINGSIZE;
+
+  int count = SYSCALL(READLINE, asid - 1, (unsigned int) line, max);
 
-    s++;
+  for (int i = 0; i < count; i++) {
+    arg->string[i] = line[i];
   }
+  return count;
 }
@@ -15,5 +15,6 @@ void SSTHandler(int asid);
 void terminate(int asid);
 void writePrinter(int asid, sst_print_PTR arg);
 void writeTerminal(int asid, sst_print_PTR arg);
+int readTerminal(int asid, sst_print_PTR arg);
 
 #endif
\ No newline at end of file
@@ -4,22 +4,14 @@
 
 extern pcb_PTR current_process;
 extern pcb_PTR ssi_pcb;
-extern pcb_PTR mutexHolderProcess;
-extern pcb_PTR swapMutexProcess;
+extern pcb_t *swapLockHolder();
+extern void releaseSwapLock();
 
 /**
  * @brief Handles exceptions at the support level
+ * @param supPtr The support structure of the current process, passed up by the nucleus
  */
-void supportExceptionHandler() {
-    // Request the support structure of the current process from the SSI 
-    support_t *supPtr;
-    ssi_payload_t payload = {
-    .service_code = GETSUPPORTPTR,
-    .arg = NULL,
-    };
-    SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &payload, 0);
-    SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &supPtr, 0);
-
+void supportExceptionHandler(support_t *supPtr) {
     // Get the processor state at the time of the exception
     state_t *supExceptionState = &(supPtr->sup_exceptState[GENERALEXCEPT]);
 
@@ -74,6 +66,8 @@ void supportSyscallHandler(state_t *supExceptionState) {
 void sendMsg(state_t *supExceptionState) {
     if(supExceptionState->reg_a1 == PARENT) {
       SYSCALL(SENDMESSAGE, (unsigned int)current_process->p_parent, supExceptionState->reg_a2, 0);
+      // Hand the rest of the slice to the SST, so the request is served right away
+      SYSCALL(YIELDTO, (unsigned int)current_process->p_parent, 0, 0);
     } else {
       SYSCALL(SENDMESSAGE, supExceptionState->reg_a1, supExceptionState->reg_a2, 0);
     }
@@ -94,9 +88,9 @@ void receiveMsg(state_t *supExceptionState) {
  * @param supExceptionState Processor state at the time of the exception
  */
 void supportTrapHandler(state_t *supExceptionState) {
-    // If the process had a mutex, release it by sending a message to swapMutex
-    if(current_process == mutexHolderProcess)
-        SYSCALL(SENDMESSAGE, (unsigned int)swapMutexProcess, 0, 0);   
+    // If the process holds the swap pool lock, release it
+    if(current_process == swapLockHolder())
+        releaseSwapLock();
 
     ssi_payload_t term_process_payload = {
         .service_code = TERMPROCESS,
@@ -12,7 +12,7 @@
 #include "../headers/types.h"
 #include "../headers/const.h"
 
-void supportExceptionHandler();
+void supportExceptionHandler(support_t *supPtr);
 void supportSyscallHandler(state_t *supExceptionState);
 void sendMsg(state_t *supExceptionState);
 void receiveMsg(state_t *supExceptionState);
@@ -3,9 +3,11 @@
 
 extern pcb_PTR current_process;
 extern pcb_PTR ssi_pcb;
-extern pcb_PTR mutexHolderProcess;
-extern pcb_PTR swapMutexProcess;
+extern unsigned int swap_lock;
 extern swpo_t swap_pool[POOLSIZE];
+extern void ampAcquire();
+extern void ampRelease();
+extern int ampIsRunning(int asid);
 
 /**
  * @brief Handles the case where an attempt is made to access a virtual address
@@ -39,17 +41,9 @@ void uTLB_RefillHandler() {
 /**
  * @brief Implements the paging algorithm. Handles page faults by swapping pages
  *        between the memory and the backing store.
+ * @param support_PTR The support structure of the current process, passed up by the nucleus
  */
-void pager() {
-    // Retrieve the support structure for the current process from the SSI
-    support_t *support_PTR;
-    ssi_payload_t payload = {
-    .service_code = GETSUPPORTPTR,
-    .arg = NULL,
-    };
-    SYSCALL(SENDMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &payload, 0);
-    SYSCALL(RECEIVEMESSAGE, (unsigned int) ssi_pcb, (unsigned int) &support_PTR, 0);
-
+void pager(support_t *support_PTR) {
     // Get the cause of the exception
     int exceptCause = support_PTR->sup_exceptState[PGFAULTEXCEPT].cause;
 
@@ -58,10 +52,9 @@ void pager() {
         supportTrapHandler(&support_PTR->sup_exceptState[PGFAULTEXCEPT]);
     }
     else {
-        // Ensure mutual exclusion on the swap pool by sending a message to the swap mutex process
-        if (current_process != mutexHolderProcess) {
-            SYSCALL(SENDMESSAGE, (unsigned int)swapMutexProcess, 0, 0);
-            SYSCALL(RECEIVEMESSAGE, (unsigned int)swapMutexProcess, 0, 0);
+        // Ensure mutual exclusion on the swap pool
+        if (swapLockHolder() != current_process) {
+            acquireSwapLock();
         }
 
         // Extract the page number from entryHi
@@ -70,12 +63,12 @@ void pager() {
             p = 31;
         }
 
-        // Select a frame to replace
+        // Select a frame to replace, invalidating the page it contains
         unsigned int i = selectFrame();
 
-        // If the frame already contains a page, invalidate it
+        // If the frame contained a page, write it back
         if (swap_pool[i].swpo_asid != NOPROC) {
-            invalidateFrame(i, support_PTR);
+            writeBackFrame(i, support_PTR);
         }
 
         // Read the page from the backing store into the selected frame
@@ -84,8 +77,17 @@ void pager() {
             blockToUpload = 31;
         }
         memaddr frameAddr = (memaddr)SWAP_POOL_AREA + (i * PAGESIZE);
-        dtpreg_t *flashDevReg = (dtpreg_t *)DEV_REG_ADDR(FLASHINT, support_PTR->sup_asid - 1);
-        int status = readWriteBackingStore(flashDevReg, frameAddr, p, FLASHREAD);
+        int status;
+        if (p == 31 && !(support_PTR->sup_privatePgTbl[p].pte_entryLO & SWAPPEDOUT)) {
+            // The stack page was never written back: it starts zero-filled, no read needed
+            if (!swap_pool[i].swpo_zeroed) {
+                zeroFrame(frameAddr, 0, PAGESIZE / WORDLEN);
+            }
+            status = READY;
+        } else {
+            int written = (support_PTR->sup_privatePgTbl[p].pte_entryLO & SWAPPEDOUT) != 0;
+            status = readWriteBackingStore(support_PTR->sup_asid, frameAddr, p, FLASHREAD, written);
+        }
         
         // Handle failed read operation as a trap
         if (status != 1) {
@@ -96,6 +98,7 @@ void pager() {
         swap_pool[i].swpo_asid = support_PTR->sup_asid;
         swap_pool[i].swpo_page = p;
         swap_pool[i].swpo_pte_ptr = &(support_PTR->sup_privatePgTbl[p]);
+        swap_pool[i].swpo_zeroed = FALSE;
 
         // Disable interrupts
         setSTATUS(getSTATUS() & (~IECON));
@@ -113,7 +116,7 @@ void pager() {
         setSTATUS(getSTATUS() | IECON);
 
         // Release the mutex
-        SYSCALL(SENDMESSAGE, (unsigned int)swapMutexProcess, 0, 0);
+        releaseSwapLock();
 
         // Return control to the current process
         LDST(&support_PTR->sup_exceptState[PGFAULTEXCEPT]);
@@ -121,55 +124,176 @@ void pager() {
 }
 
 /**
- * @brief Selects the frame to replace (FIFO - First In, First Out).
- * @return The index of the frame to replace
+ * @brief Acquires the swap pool lock.
+ *        The lock word is checked and set with interrupts disabled, so the uncontended
+ *        case needs no syscall. Otherwise the process blocks in the nucleus wait table,
+ *        lending its priority to the holder, and tries again once woken up.
  */
-static unsigned int selectFrame() {
+void acquireSwapLock() {
+    int waited = FALSE;
+
+    setSTATUS(getSTATUS() & (~IECON));
+    while (swap_lock != 0) {
+        swap_lock |= SWAPLOCKWAITERS;
+        // The state is saved with interrupts disabled, so the loop goes on atomically
+        SYSCALL(WAITWORD, (unsigned int)&swap_lock, swap_lock, swap_lock & (~SWAPLOCKWAITERS));
+        waited = TRUE;
+    }
+    // Other processes may still be waiting behind a process that had to wait
+    swap_lock = (unsigned int)current_process | (waited ? SWAPLOCKWAITERS : 0);
+    setSTATUS(getSTATUS() | IECON);
+}
 
-    // Scan through all the frames in the swap pool
-    for (int i = 0; i < POOLSIZE; i++) {
+/**
+ * @brief Releases the swap pool lock, waking up one waiter if there is any.
+ */
+void releaseSwapLock() {
+    setSTATUS(getSTATUS() & (~IECON));
+    unsigned int old = swap_lock;
+    swap_lock = 0;
+    setSTATUS(getSTATUS() | IECON);
 
-        // If there is an empty frame, return it
-        if (swap_pool[i].swpo_asid == NOPROC)
-            return i;
+    if (old & SWAPLOCKWAITERS) {
+        SYSCALL(WAKEWORD, (unsigned int)&swap_lock, 1, 0);
     }
+}
 
-    // Otherwise, return the index of the frame containing the oldest page
+/**
+ * @brief Returns the process holding the swap pool lock.
+ *
+ * @return Pointer to the holder, or NULL if the lock is free
+ */
+pcb_t *swapLockHolder() {
+    return (pcb_t *)(swap_lock & (~SWAPLOCKWAITERS));
+}
+
+/**
+ * @brief Selects the frame to replace (FIFO - First In, First Out) and invalidates the page it contains.
+ *        In AMP mode the pages of U-procs running on a secondary processor are skipped:
+ *        selection and invalidation happen under the AMP lock, so the owner of the
+ *        selected page cannot be dispatched with a stale TLB in between.
+ * @return The index of the frame to replace
+ */
+static unsigned int selectFrame() {
     static int last = -1;
-    return last = (last + 1) % POOLSIZE;
+
+    while (TRUE) {
+        // Disable interrupts and keep the secondary processors away from the swap pool
+        setSTATUS(getSTATUS() & (~IECON));
+        ampAcquire();
+
+        // Scan through all the frames in the swap pool
+        int empty = -1;
+        for (int i = 0; i < POOLSIZE; i++) {
+
+            // If there is an empty frame, prefer one already zero-filled
+            if (swap_pool[i].swpo_asid == NOPROC && (empty == -1 || swap_pool[i].swpo_zeroed)) {
+                empty = i;
+            }
+        }
+        if (empty != -1) {
+            ampRelease();
+            setSTATUS(getSTATUS() | IECON);
+            return empty;
+        }
+
+        // Otherwise, return the index of the frame containing the oldest page
+        for (int tries = 0; tries < POOLSIZE; tries++) {
+            last = (last + 1) % POOLSIZE;
+            if (!ampIsRunning(swap_pool[last].swpo_asid)) {
+                invalidateFrame(last);
+                ampRelease();
+                setSTATUS(getSTATUS() | IECON);
+                return last;
+            }
+        }
+
+        // Every owner is running on a secondary processor: let them be preempted and retry
+        ampRelease();
+        setSTATUS(getSTATUS() | IECON);
+    }
 }
 
 /**
  * @brief Invalidates a page in the swap pool by clearing its valid bit.
+ *        Must be called with interrupts disabled.
  * @param frame The index of the frame to invalidate
- * @param support_PTR The pointer to the support structure of the current process
  */
-void invalidateFrame(unsigned int frame, support_t *support_PTR){
-    // Disable interrupts
-    setSTATUS(getSTATUS() & (~IECON));
-
+void invalidateFrame(unsigned int frame){
     // Clear the valid bit in the page table entry
     swap_pool[frame].swpo_pte_ptr->pte_entryLO &= (~VALIDON);
 
     // Update the TLB
     updateTLB(swap_pool[frame].swpo_pte_ptr);
-    
-    // Re-enable interrupts
-    setSTATUS(getSTATUS() | IECON);
+}
 
+/**
+ * @brief Writes the page contained in a frame of the swap pool back to the backing store.
+ * @param frame The index of the frame to write back
+ * @param support_PTR The pointer to the support structure of the current process
+ */
+void writeBackFrame(unsigned int frame, support_t *support_PTR){
     // Update the backing store by writing the page back
     int blockToUpload = (swap_pool[frame].swpo_pte_ptr->pte_entryHI & GETPAGENO) >> VPNSHIFT;
     if(blockToUpload == 0x3FFFF){
         blockToUpload = 31;
     }
     memaddr frameAddr = (memaddr) SWAP_POOL_AREA + (frame * PAGESIZE);
-    dtpreg_t *flashDevReg = (dtpreg_t *)DEV_REG_ADDR(FLASHINT, support_PTR->sup_asid - 1);
-    int status = readWriteBackingStore(flashDevReg, frameAddr, blockToUpload, FLASHWRITE);
+    // The page goes back to the backing store of the U-proc owning the frame
+    int status = readWriteBackingStore(swap_pool[frame].swpo_asid, frameAddr, blockToUpload, FLASHWRITE, TRUE);
 
     // Handle failed write operation as a trap
     if (status != 1) {
         supportTrapHandler(&support_PTR->sup_exceptState[PGFAULTEXCEPT]);
     }
+
+    // From now on the page must be read back from the backing store
+    swap_pool[frame].swpo_pte_ptr->pte_entryLO |= SWAPPEDOUT;
+}
+
+/**
+ * @brief Zero-fills part of a frame.
+ * @param frameAddr The starting memory address of the frame
+ * @param from Index of the first word to clear
+ * @param to Index past the last word to clear
+ */
+void zeroFrame(memaddr frameAddr, unsigned int from, unsigned int to) {
+    unsigned int *words = (unsigned int *) frameAddr;
+    for (unsigned int w = from; w < to; w++) {
+        words[w] = 0;
+    }
+}
+
+/**
+ * @brief Idle task: zero-fills the free frames of the swap pool, ZEROCHUNK words per step,
+ *        so that the next page fault on a fresh stack page needs neither I/O nor clearing.
+ *        Runs in the nucleus while no process is ready, so it backs off whenever a pager
+ *        holds the swap pool lock: a frame may have been selected but not assigned yet.
+ * @return TRUE if there are frames left to zero-fill, FALSE otherwise
+ */
+int zeroFreeFrames() {
+    static int frame = 0;
+    static unsigned int word = 0;
+
+    if (swap_lock != 0)
+        return FALSE;
+
+    for (int tries = 0; tries < POOLSIZE; tries++) {
+        if (swap_pool[frame].swpo_asid == NOPROC && !swap_pool[frame].swpo_zeroed) {
+            memaddr frameAddr = (memaddr) SWAP_POOL_AREA + (frame * PAGESIZE);
+            zeroFrame(frameAddr, word, word + ZEROCHUNK);
+            word += ZEROCHUNK;
+            if (word == PAGESIZE / WORDLEN) {
+                swap_pool[frame].swpo_zeroed = TRUE;
+                word = 0;
+            }
+            return TRUE;
+        }
+        // Move on to the next frame, restarting from its first word
+        frame = (frame + 1) % POOLSIZE;
+        word = 0;
+    }
+    return FALSE;
 }
 
 /**
@@ -196,34 +320,32 @@ void updateTLB(pteEntry_t *entry) {
 }
 
 /**
- * @brief Reads from or writes to the backing store (flash device).
+ * @brief Reads from or writes to the backing store (flash device, or disk if BACKINGSTORE is DISKBACK).
+ * Nothing loads the U-proc images on the disk: a page never written back is read from
+ * its flash device, where the image is, and goes to the disk on its first write back.
  * 
- * @param flashDevReg   The device register of the flash device involved in the operation.
+ * @param asid          The ASID of the U-proc owning the page.
  * @param dataMemAddr   The starting memory address of the block in RAM involved in the operation.
- * @param devBlockNo    The block number on the flash device to be read or written.
+ * @param devBlockNo    The page number, i.e. the block number on the flash device to be read or written.
  * @param opType        FLASHREAD: the block devBlockNo on the flash device will be read into dataMemAddr.
  *                      FLASHWRITE: the contents of dataMemAddr will be written to the block devBlockNo on the flash device.
+ * @param written       TRUE if the page has been written back to the backing store since the U-proc started.
  * 
  * @return              The result of the read or write operation.
  */
-int readWriteBackingStore(dtpreg_t *flashDevReg, memaddr dataMemAddr, unsigned int devBlockNo, unsigned int opType) {
+int readWriteBackingStore(int asid, memaddr dataMemAddr, unsigned int devBlockNo, unsigned int opType, int written) {
+    if (BACKINGSTORE == DISKBACK && written) {
+        // The U-procs share VMDISK, MAXPAGES blocks each: the disk scheduler orders their requests
+        dtpreg_t *diskDevReg = (dtpreg_t *)DEV_REG_ADDR(DISKINT, VMDISK);
+        unsigned int diskBlockNo = ((asid - 1) * MAXPAGES) + devBlockNo;
+        unsigned int diskOp = (opType == FLASHREAD) ? DISKREAD : DISKWRITE;
+        return SYSCALL(DISKIO, (unsigned int)&diskDevReg->command, diskOp | (diskBlockNo << 8), dataMemAddr);
+    }
+
     // Load the data0 register of the flash device with the address of the memory block
+    dtpreg_t *flashDevReg = (dtpreg_t *)DEV_REG_ADDR(FLASHINT, asid - 1);
     flashDevReg->data0 = dataMemAddr;
 
-    // Prepare the structures for the SSI operation
-    ssi_do_io_t doIO = {
-        .commandAddr = (memaddr*)&flashDevReg->command,
-        .commandValue = opType | (devBlockNo << 8)
-    };
-    ssi_payload_t payload = {
-        .service_code = DOIO,
-        .arg = &doIO
-    };
-
-    // Send the message to the SSI
-    unsigned int status;
-    SYSCALL(SENDMESSAGE, (unsigned int)ssi_pcb, (unsigned int)(&payload), 0);
-    SYSCALL(RECEIVEMESSAGE, (unsigned int)ssi_pcb, (unsigned int) &status, 0);
-
-    return status;
+    // Start the operation and wait for its completion in the nucleus
+    return SYSCALL(KDOIO, (unsigned int)&flashDevReg->command, opType | (devBlockNo << 8), 0);
 }
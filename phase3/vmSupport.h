@@ -11,10 +11,16 @@
 #include "../headers/types.h"
 
 void uTLB_RefillHandler();
-void pager();
+void pager(support_t *support_PTR);
+void acquireSwapLock();
+void releaseSwapLock();
+pcb_t *swapLockHolder();
 static unsigned int selectFrame();
-void invalidateFrame(unsigned int frame, support_t *support_PTR);
+void invalidateFrame(unsigned int frame);
+void writeBackFrame(unsigned int frame, support_t *support_PTR);
+void zeroFrame(memaddr frameAddr, unsigned int from, unsigned int to);
+int zeroFreeFrames();
 void updateTLB(pteEntry_t *entry);
-int readWriteBackingStore(dtpreg_t *flashDevReg, memaddr dataMemAddr, unsigned int devBlockNo, unsigned int opType);
+int readWriteBackingStore(int asid, memaddr dataMemAddr, unsigned int devBlockNo, unsigned int opType, int written);
 
 #endif
\ No newline at end of file
@@ -5,6 +5,7 @@
 #define TERMINATE 2
 #define WRITEPRINTER 3
 #define WRITETERMINAL 4
+#define READTERMINAL 5
 
 #define PARENT 0
 